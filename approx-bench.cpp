@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "approx-engine.h"
+
+// Pomiar silnika gry w jednym procesie, bez gniazd: gracze dołączają,
+// wysyłają PUT-y w zadanym tempie czasu wirtualnego, STATE są zbierane
+// co `-d` operacji, a na końcu liczony jest wynik.
+// Z --kernels porównuje jądra wielomianu (approx-poly.h) dla N = 1..8.
+
+int players = 64;
+long long ops = 5000000;
+int K = 100;
+int N = 4;
+int drain_every = 1024;
+uint64_t seed = 1;
+bool kernels_only = false;
+
+static void print_error(const std::string& msg) {
+    std::cerr << "ERROR: " << msg << "\n";
+}
+
+static bool parse_arguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-p" && i + 1 < argc) {
+            players = std::atoi(argv[++i]);
+            if (players < 1) {
+                print_error("Invalid value for -p (players)");
+                return false;
+            }
+        } else if (arg == "-o" && i + 1 < argc) {
+            ops = std::atoll(argv[++i]);
+            if (ops < 1) {
+                print_error("Invalid value for -o (operations)");
+                return false;
+            }
+        } else if (arg == "-k" && i + 1 < argc) {
+            K = std::atoi(argv[++i]);
+            if (K < 1) {
+                print_error("Invalid value for -k (K)");
+                return false;
+            }
+        } else if (arg == "-n" && i + 1 < argc) {
+            N = std::atoi(argv[++i]);
+            if (N < 1 || N > 8) {
+                print_error("Invalid value for -n (N)");
+                return false;
+            }
+        } else if (arg == "-d" && i + 1 < argc) {
+            drain_every = std::atoi(argv[++i]);
+            if (drain_every < 1) {
+                print_error("Invalid value for -d (drain interval)");
+                return false;
+            }
+        } else if (arg == "-s" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--kernels") {
+            kernels_only = true;
+        } else {
+            print_error("Unknown or incomplete argument: " + arg);
+            return false;
+        }
+    }
+    return true;
+}
+
+struct bench_put {
+    int player;
+    int point;
+    double value;
+};
+
+// Suma kwadratów błędów na gęstym approx z K + 1 punktów: ogólna pętla
+// kontra jądro dla stałego N, około `ops` punktów na pomiar.
+static void bench_kernels() {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uni(-1.0, 1.0);
+    std::vector<double> values(K + 1);
+    for (double &v : values) v = 5.0 * uni(rng);
+    long long reps = std::max<long long>(1, ops / (K + 1));
+
+    auto run = [&](const poly_kernels &kern, const std::vector<double> &c,
+                   int n, double &result) {
+        double sink = 0.0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (long long r = 0; r < reps; ++r)
+            sink += kern.sse_dense(c.data(), n, values.data(), K);
+        auto t1 = std::chrono::steady_clock::now();
+        result = sink / reps;
+        return std::chrono::duration<double, std::nano>(t1 - t0).count() /
+            (static_cast<double>(reps) * (K + 1));
+    };
+
+    std::cout << "K " << K << ", " << reps << " passes per kernel\n";
+    std::cout << "N  general ns/pt  fixed ns/pt  speedup  rel.diff\n";
+    for (int n = 1; n <= POLY_MAX_DEGREE; ++n) {
+        // Współczynniki małe, żeby sumy nie uciekały do nieskończoności.
+        std::vector<double> c(n + 1);
+        for (double &a : c) a = uni(rng) / std::pow(K + 1.0, n);
+        double r_general = 0.0, r_fixed = 0.0;
+        double t_general = run(POLY_GENERAL_KERNELS, c, n, r_general);
+        double t_fixed = run(select_poly_kernels(n), c, n, r_fixed);
+        double rel = r_general == 0.0 ? 0.0 :
+            std::fabs(r_fixed - r_general) / std::fabs(r_general);
+        std::printf("%d  %13.3f  %11.3f  %6.2fx  %.1e\n", n, t_general,
+                    t_fixed, t_general / t_fixed, rel);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_arguments(argc, argv)) return 1;
+    if (kernels_only) {
+        bench_kernels();
+        return 0;
+    }
+
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> coeff(-1.0, 1.0);
+    // Co setny PUT jest poza zakresem, żeby liczyć też ścieżkę BAD_PUT.
+    std::uniform_int_distribution<int> point(0, K + K / 100);
+    std::uniform_real_distribution<double> value(-5.0, 5.0);
+    std::uniform_int_distribution<int> who(0, players - 1);
+
+    std::vector<bench_put> script(static_cast<size_t>(ops));
+    for (bench_put &p : script) p = {who(rng), point(rng), value(rng)};
+
+    approx_engine engine(K, N);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int id = 0; id < players; ++id) {
+        engine.open(id);
+        std::vector<double> c(N + 1);
+        for (double &a : c) a = coeff(rng);
+        // Same wielkie litery: STATE bez opóźnienia.
+        engine.join(id, "P" + std::to_string(id), std::move(c));
+    }
+
+    // Czas wirtualny: 1 µs na operację.
+    auto now = std::chrono::steady_clock::time_point{};
+    long long accepted = 0, rejected = 0, states = 0;
+    auto t1 = std::chrono::steady_clock::now();
+    for (long long i = 0; i < ops; ++i) {
+        const bench_put &p = script[i];
+        now += std::chrono::microseconds(1);
+        if (engine.put(p.player, p.point, p.value, now).accepted())
+            ++accepted;
+        else
+            ++rejected;
+        if ((i + 1) % drain_every == 0) {
+            engine.drain_due_states(now,
+                [&states](int, const approx_player &) { ++states; });
+        }
+    }
+    engine.drain_due_states(now,
+        [&states](int, const approx_player &) { ++states; });
+    auto t2 = std::chrono::steady_clock::now();
+    auto results = engine.score();
+    auto t3 = std::chrono::steady_clock::now();
+
+    double put_s = std::chrono::duration<double>(t2 - t1).count();
+    double score_s = std::chrono::duration<double>(t3 - t2).count();
+    double checksum = 0.0;
+    for (const auto &r : results) checksum += r.second;
+    std::cout << "players " << players << ", K " << K << ", N " << N
+              << ", join " << std::chrono::duration<double>(t1 - t0).count()
+              << " s\n";
+    std::cout << ops << " PUTs (" << accepted << " accepted, " << rejected
+              << " rejected), " << states << " STATE in " << put_s << " s ("
+              << (put_s > 0 ? ops / put_s : 0.0) << " PUT/s)\n";
+    std::cout << "score: " << score_s << " s, checksum " << checksum << "\n";
+    return 0;
+}
@@ -11,11 +11,29 @@
 #include <fcntl.h>
 #include <cerrno>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <charconv>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "approx-histogram.h"
+#include "approx-poly.h"
+#include "approx-probes.h"
+#include "approx-shm.h"
 
 
 std::string player_id, server;
 int port = -1;
 bool force4 = false, force6 = false, auto_mode = false;
+std::string replay_path{};   // -r: skrypt PUT-ów do odtworzenia
+double replay_rate = 0.0;    // -R: docelowa liczba PUT/s (0 = bez limitu)
+std::string local_path{};    // -L: gniazdo uniksowe serwera na tej maszynie
 
 static void print_error(const std::string& msg) {
     std::cerr << "ERROR: " << msg << "\n";
@@ -63,15 +81,31 @@ bool parse_arguments(int argc, char *argv[]) {
             force6 = true;
         } else if (arg == "-a") {
             auto_mode = true;
+        } else if (arg == "-r" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "-R" && i + 1 < argc) {
+            replay_rate = std::atof(argv[++i]);
+            if (replay_rate < 0) {
+                print_error("Invalid value for -R (rate)");
+                return false;
+            }
+        } else if (arg == "-L" && i + 1 < argc) {
+            local_path = argv[++i];
         } else {
             print_error("Unknown or incomplete argument: " + arg);
             return false;
         }
     }
-    if (!u || !s || !p) {
+    // Z -L łączymy się lokalnie i -s/-p nie są potrzebne.
+    bool local = !local_path.empty();
+    if (!u || (!local && (!s || !p))) {
         if (!u) print_error("Missing required -u argument (player_id)");
-        if (!s) print_error("Missing required -s argument (server)");
-        if (!p) print_error("Missing required -p argument (port)");
+        if (!s && !local) print_error("Missing required -s argument (server)");
+        if (!p && !local) print_error("Missing required -p argument (port)");
+        return false;
+    }
+    if (auto_mode && !replay_path.empty()) {
+        print_error("Options -a and -r are mutually exclusive");
         return false;
     }
     return true;
@@ -120,13 +154,93 @@ int connect_to_server() {
     return sockfd;
 }
 
+// Kanał w pamięci współdzielonej (-L); nullptr przy zwykłym TCP.
+// Zwracane gniazdo uniksowe służy wtedy tylko do wykrycia rozłączenia.
+static shm_channel *local_channel = nullptr;
+static int local_wake_server = -1;  // eventfd budzący serwer
+static int local_wake_client = -1;  // eventfd, którym serwer budzi nas
+
+int connect_local() {
+    sockaddr_un sa{};
+    if (local_path.size() >= sizeof(sa.sun_path)) {
+        print_error("Path for -L is too long");
+        return -1;
+    }
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path, local_path.c_str(), local_path.size() + 1);
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0 ||
+        connect(sockfd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) != 0) {
+        print_error("Could not connect to server");
+        if (sockfd >= 0) close(sockfd);
+        return -1;
+    }
+    shm_handshake hs{};
+    int fds[SHM_HANDSHAKE_FDS];
+    int nfds = 0;
+    bool ok = recv_with_fds(sockfd, &hs, sizeof(hs), fds,
+                            SHM_HANDSHAKE_FDS, nfds);
+    void *mem = MAP_FAILED;
+    if (ok && nfds == SHM_HANDSHAKE_FDS &&
+        memcmp(hs.magic, SHM_MAGIC, sizeof(hs.magic)) == 0 &&
+        hs.version == SHM_VERSION && hs.size == sizeof(shm_channel)) {
+        mem = mmap(nullptr, sizeof(shm_channel), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fds[0], 0);
+    }
+    if (nfds > 0) close(fds[0]);
+    if (mem == MAP_FAILED) {
+        print_error("Local handshake with server failed");
+        for (int i = 1; i < nfds; ++i) close(fds[i]);
+        close(sockfd);
+        return -1;
+    }
+    local_channel = static_cast<shm_channel*>(mem);
+    local_wake_server = fds[1];
+    local_wake_client = fds[2];
+    std::cout << "Connected to server [" << local_path << "].\n";
+    return sockfd;
+}
+
+// send()/recv() albo zapis/odczyt pierścienia, zależnie od transportu.
+// Pusty lub pełny pierścień zgłaszamy jak nieblokujące gniazdo (EAGAIN).
+static ssize_t transport_send(int sockfd, const char *buf, size_t len,
+    int flags) {
+    if (local_channel == nullptr) return send(sockfd, buf, len, flags);
+    size_t n = 0;
+    if (!shm_ring_write(local_channel->to_server, buf, len, n)) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    shm_ring_notify(local_channel->to_server, local_wake_server);
+    return static_cast<ssize_t>(n);
+}
+
+static ssize_t transport_recv(int sockfd, char *buf, size_t len) {
+    if (local_channel == nullptr) return recv(sockfd, buf, len, 0);
+    size_t n = 0;
+    if (!shm_ring_read(local_channel->to_client, buf, len, n)) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (n == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return static_cast<ssize_t>(n);
+}
+
 // --------------------
 // 4. Wysyłanie HELLO
 // --------------------
 
 bool send_hello(int sockfd) {
     std::string hello_msg = "HELLO " + player_id + "\r\n";
-    ssize_t sent = send(sockfd, hello_msg.c_str(), hello_msg.size(), 0);
+    ssize_t sent = transport_send(sockfd, hello_msg.c_str(),
+                                  hello_msg.size(), 0);
     if (sent < 0) {
         print_error("Failed to send HELLO message");
         return false;
@@ -148,6 +262,241 @@ bool parse_put_line(const std::string &line, int &point, double &value) {
     return true;
 }
 
+// ---------------------------------------------------
+// 5a. Pomiar opóźnień PUT -> odpowiedź serwera
+// ---------------------------------------------------
+
+// Każdy wysłany PUT dostaje znacznik czasu. BAD_PUT i PENALTY przychodzą
+// od razu, w kolejności PUT-ów, i powtarzają ich argumenty, więc PUT-y
+// pominięte przed dopasowanym zostały przyjęte i czekają na STATE.
+// Serwer stosuje PUT-y w kolejności wysłania i może połączyć kilka w jeden
+// STATE, wysyłany sekundę za każdą małą literę w player_id po najnowszym
+// z nich. STATE odpowiada więc na pewien początek kolejki PUT-ów bez
+// odpowiedzi: najkrótszy, po którym wartości we wszystkich punktach
+// z takimi PUT-ami zgadzają się z linią STATE. Szukamy go kursorami
+// w kolejkach poszczególnych punktów, które tylko idą do przodu, więc
+// koszt STATE zależy od liczby takich punktów i zamkniętych PUT-ów,
+// a nie od długości kolejki. Czas liczymy od najnowszego zamkniętego
+// PUT-a, minus opóźnienie. Podsumowanie drukujemy przy SCORING.
+
+struct put_in_flight {
+    std::chrono::steady_clock::time_point sent;
+    int point;
+    double value;
+    uint64_t seq;   // numer kolejny PUT-a, od 1
+};
+
+// PUT-y bez STATE, w kolejności wysłania. Pierwsze puts_accepted z nich
+// serwer już przyjął (były przed odrzuconym PUT-em).
+static std::deque<put_in_flight> puts_pending;
+static size_t puts_accepted = 0;
+static uint64_t next_put_seq = 1;
+// Te same PUT-y pogrupowane po punktach: numery i wartości.
+static std::map<int, std::deque<std::pair<uint64_t, double>>> pending_points;
+// Nasze approx w punktach, których dotykały PUT-y, według ostatniego STATE.
+static std::unordered_map<int, double> known_values;
+static latency_histogram state_rtt;   // PUT -> STATE, bez opóźnienia
+static uint64_t state_puts = 0;       // PUT-y zamknięte przez STATE
+static uint64_t state_lines = 0;      // wszystkie odebrane STATE
+static latency_histogram reject_rtt;  // PUT -> BAD_PUT / PENALTY
+// Ostatni BAD_PUT: PENALTY tuż po nim z tymi samymi argumentami dotyczy
+// tego samego PUT-a (serwer wysyła wtedy obie linie).
+static bool last_bad_put = false;
+static int last_bad_point = 0;
+static double last_bad_value = 0.0;
+
+// Tyle sekund serwer celowo wstrzymuje nasz STATE.
+static int lowercase_letters() {
+    return static_cast<int>(std::count_if(player_id.begin(),
+        player_id.end(), [](char c) { return c >= 'a' && c <= 'z'; }));
+}
+
+static void track_put_sent(int point, double value,
+    std::chrono::steady_clock::time_point now) {
+    uint64_t seq = next_put_seq++;
+    puts_pending.push_back({now, point, value, seq});
+    pending_points[point].push_back({seq, value});
+}
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point from,
+    std::chrono::steady_clock::time_point to) {
+    return std::max<int64_t>(0, std::chrono::duration_cast<
+        std::chrono::nanoseconds>(to - from).count());
+}
+
+static bool same_put_value(double a, double b) {
+    // Serwer odsyła wartość z 6 cyframi znaczącymi.
+    return std::fabs(a - b) <= 1e-5 * std::max(1.0, std::fabs(b));
+}
+
+static void track_rejection(const std::string &args, bool bad_put,
+    std::chrono::steady_clock::time_point now) {
+    std::istringstream iss(args);
+    int point;
+    double value;
+    if (!(iss >> point >> value)) return;
+    bool repeat = !bad_put && last_bad_put && point == last_bad_point &&
+        same_put_value(value, last_bad_value);
+    last_bad_put = bad_put;
+    last_bad_point = point;
+    last_bad_value = value;
+    if (repeat) return;
+    auto pp = pending_points.find(point);
+    if (pp == pending_points.end()) return;
+    // Odrzucony jest pierwszy pasujący PUT w tym punkcie spośród tych,
+    // o których serwer jeszcze nic nie powiedział.
+    uint64_t first_open = puts_accepted < puts_pending.size() ?
+        puts_pending[puts_accepted].seq : next_put_seq;
+    auto &q = pp->second;
+    auto e = std::find_if(q.begin(), q.end(),
+        [first_open, value](const std::pair<uint64_t, double> &put) {
+            return put.first >= first_open &&
+                same_put_value(value, put.second);
+        });
+    if (e == q.end()) return;
+    auto it = std::lower_bound(puts_pending.begin(), puts_pending.end(),
+        e->first, [](const put_in_flight &p, uint64_t seq) {
+            return p.seq < seq;
+        });
+    q.erase(e);
+    if (q.empty()) pending_points.erase(pp);
+    reject_rtt.record(elapsed_ns(it->sent, now));
+    puts_accepted = it - puts_pending.begin();
+    puts_pending.erase(it);
+}
+
+// `got` to NAN dla punktu spoza STATE: taki PUT dostanie BAD_PUT, więc
+// niczego nie rozstrzyga.
+static bool same_state_value(double expect, double got) {
+    // STATE też ma 6 cyfr znaczących.
+    return std::isnan(got) ||
+        std::fabs(expect - got) <= 1e-5 * std::max(1.0, std::fabs(got));
+}
+
+// Wartości linii STATE w rosnących punktach, bez parsowania reszty linii
+// (przy -r STATE przychodzą setkami tysięcy).
+struct state_cursor {
+    const char *p;
+    const char *end;
+    int x{0};
+
+    explicit state_cursor(const std::string &line)
+        : p(line.c_str() + 6), end(line.c_str() + line.size()) {}
+
+    // NAN dla punktu spoza linii.
+    double at(int point) {
+        if (point < x) return NAN;
+        while (x < point) {
+            const char *space = static_cast<const char*>(
+                memchr(p, ' ', end - p));
+            if (space == nullptr) return NAN;
+            p = space + 1;
+            ++x;
+        }
+        return std::strtod(p, nullptr);
+    }
+};
+
+// Kursor w kolejce jednego punktu podczas dopasowywania STATE.
+struct point_match {
+    int point;
+    std::deque<std::pair<uint64_t, double>> *puts;
+    double got;
+    double expect;  // wartość po pierwszych `count` PUT-ach
+    size_t count;
+};
+
+static void track_state(const std::string &line,
+    std::chrono::steady_clock::time_point now) {
+    last_bad_put = false;
+    state_lines++;
+    if (puts_pending.empty()) return;
+
+    static std::vector<point_match> match;
+    match.clear();
+    state_cursor cursor(line);
+    for (auto &[point, q] : pending_points) {
+        auto known = known_values.find(point);
+        match.push_back({point, &q, cursor.at(point),
+            known != known_values.end() ? known->second : 0.0, 0});
+    }
+    // `through` rośnie, aż wszystkie punkty zgodzą się ze STATE po PUT-ach
+    // do niego włącznie. Najmniejsza pasująca liczba PUT-ów w jednym
+    // punkcie nie wystarczy: PUT-y, które się znoszą, pasują przypadkiem.
+    uint64_t through = 0;   // ostatni PUT, na który odpowiada ten STATE
+    bool fits = true;
+    for (bool moved = true; moved && fits;) {
+        moved = false;
+        for (point_match &m : match) {
+            auto &q = *m.puts;
+            while (m.count < q.size() && q[m.count].first <= through)
+                m.expect += q[m.count++].second;
+            if (same_state_value(m.expect, m.got)) continue;
+            while (m.count < q.size() && !same_state_value(m.expect, m.got))
+                m.expect += q[m.count++].second;
+            if (!same_state_value(m.expect, m.got)) {
+                fits = false;
+                break;
+            }
+            through = q[m.count - 1].first;
+            moved = true;
+        }
+    }
+    // Któryś punkt nie pasuje (np. STATE urwany): jak dawniej zamykamy
+    // wszystkie PUT-y.
+    if (!fits) through = puts_pending.back().seq;
+
+    for (const point_match &m : match) {
+        if (!std::isnan(m.got)) known_values[m.point] = m.got;
+        auto &q = *m.puts;
+        while (!q.empty() && q.front().first <= through) q.pop_front();
+        if (q.empty()) pending_points.erase(m.point);
+    }
+
+    size_t answered = 0;
+    std::chrono::steady_clock::time_point newest;
+    while (!puts_pending.empty() && puts_pending.front().seq <= through) {
+        newest = puts_pending.front().sent;
+        puts_pending.pop_front();
+        answered++;
+    }
+    if (answered == 0) return;
+    puts_accepted -= std::min(puts_accepted, answered);
+    state_puts += answered;
+    state_rtt.record(elapsed_ns(
+        newest + std::chrono::seconds(lowercase_letters()), now));
+}
+
+static void print_histogram(const char *what, const latency_histogram &h) {
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    std::cout << player_id << " latency " << what << " (us): n=" << h.total
+              << " p50=" << us(h.percentile(50))
+              << " p90=" << us(h.percentile(90))
+              << " p99=" << us(h.percentile(99))
+              << " p99.9=" << us(h.percentile(99.9))
+              << " max=" << us(h.max) << ".\n";
+}
+
+static void report_client_latency() {
+    if (state_rtt.total > 0) {
+        std::string what = "PUT->STATE minus " +
+            std::to_string(lowercase_letters()) + " s delay";
+        print_histogram(what.c_str(), state_rtt);
+        if (state_puts > state_rtt.total) {
+            std::cout << player_id << " latency: " << state_puts
+                      << " PUTs answered by " << state_rtt.total << " of "
+                      << state_lines << " STATE.\n";
+        }
+    }
+    if (reject_rtt.total > 0)
+        print_histogram("PUT->BAD_PUT/PENALTY", reject_rtt);
+    size_t unanswered = puts_pending.size();
+    if (unanswered > 0) {
+        std::cout << player_id << " latency: " << unanswered
+                  << " PUTs without a response.\n";
+    }
+}
+
 // Wysyła komunikat PUT
 bool send_put(int sockfd, int point, double val) {
     char buf[128];
@@ -157,7 +506,9 @@ bool send_put(int sockfd, int point, double val) {
         return false;
     }
     std::cout << player_id << " puts " << val << " in " << point << ".\n";
-    ssize_t sent = send(sockfd, buf, len, 0);
+    APPROX_PROBE3(put_send, sockfd, point, probe_micro(val));
+    track_put_sent(point, val, std::chrono::steady_clock::now());
+    ssize_t sent = transport_send(sockfd, buf, len, 0);
     if (sent != len) {
         print_error("Failed to send PUT command to server");
         return false;
@@ -181,13 +532,206 @@ static bool auto_waiting_for_response = false;
 static int auto_K = -1;
 
 // Funkcja obliczająca wartość wielomianu z coeffs dla x
+// Jądro Hornera dla stopnia z COEFF, wybierane przy jego odebraniu.
+static const poly_kernels *poly = &POLY_GENERAL_KERNELS;
+
 double eval_poly(const std::vector<double>& coeffs, int x) {
-    double res = 0.0, xp = 1.0;
-    for (size_t i = 0; i < coeffs.size(); ++i) {
-        res += coeffs[i] * xp;
-        xp *= x;
+    return poly->eval(coeffs.data(), static_cast<int>(coeffs.size()) - 1, x);
+}
+
+// ----------- TRYB ODTWARZANIA (-r plik, -R tempo) -----------
+
+// Skrypt jest parsowany raz, przed połączeniem, do zwartej tablicy,
+// a gotowe bajty komunikatów PUT leżą jeden za drugim w replay_wire.
+// W pętli wysyłamy więc tylko kolejne kawałki tego bufora, dużymi
+// porcjami, w tempie wyznaczonym przez -R.
+struct replay_put {
+    int32_t point;
+    double value;
+};
+
+static std::vector<replay_put> replay_script;
+static std::string replay_wire;              // zserializowane "PUT x v\r\n"
+static std::vector<size_t> replay_ends;      // koniec i-tego PUT w replay_wire
+static size_t replay_sent_bytes = 0;
+static size_t replay_sent_puts = 0;
+static bool replay_blocked = false;          // czekamy na POLLOUT
+static bool replay_done_reported = false;
+static std::chrono::steady_clock::time_point replay_start{};
+static long long replay_states = 0, replay_bad_puts = 0, replay_penalties = 0;
+
+static constexpr size_t REPLAY_MAX_WRITE = 256 * 1024;
+static constexpr size_t REPLAY_READ_CHUNK = 1 << 20;
+
+static bool replay_active() {
+    return !replay_path.empty();
+}
+
+static void skip_blanks(const char *&p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+}
+
+// Parsuje bufor postaci "point value\n..." do replay_script.
+// Niepoprawne linie są zgłaszane i pomijane, jak w trybie ręcznym.
+static void parse_replay_script(const char *data, size_t size) {
+    const char *p = data;
+    const char *end = data + size;
+    while (p < end) {
+        const char *eol = static_cast<const char*>(
+            memchr(p, '\n', end - p));
+        if (eol == nullptr) eol = end;
+        const char *q = p;
+        skip_blanks(q, eol);
+        if (q == eol) {
+            p = eol + 1;
+            continue;
+        }
+        replay_put put{};
+        auto r1 = std::from_chars(q, eol, put.point);
+        bool ok = r1.ec == std::errc();
+        if (ok) {
+            q = r1.ptr;
+            skip_blanks(q, eol);
+            auto r2 = std::from_chars(q, eol, put.value);
+            ok = r2.ec == std::errc();
+            if (ok) {
+                q = r2.ptr;
+                skip_blanks(q, eol);
+                ok = q == eol;
+            }
+        }
+        if (ok) {
+            replay_script.push_back(put);
+        } else {
+            std::cout << "ERROR: invalid input line "
+                      << std::string(p, eol) << "\n";
+        }
+        p = eol + 1;
+    }
+}
+
+// Wczytuje skrypt: zwykły plik mapujemy w pamięci, a potok (lub "-",
+// czyli stdin) czytamy dużymi blokami z powiększonym buforem potoku.
+static bool load_replay_script() {
+    int fd = replay_path == "-" ? 0 : open(replay_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        print_error("Cannot open replay script " + replay_path);
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            print_error("mmap() of replay script failed");
+            if (fd != 0) close(fd);
+            return false;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        parse_replay_script(static_cast<const char*>(map), st.st_size);
+        munmap(map, st.st_size);
+    } else {
+#ifdef F_SETPIPE_SZ
+        fcntl(fd, F_SETPIPE_SZ, static_cast<int>(REPLAY_READ_CHUNK));
+#endif
+        std::string data;
+        std::vector<char> chunk(REPLAY_READ_CHUNK);
+        while (true) {
+            ssize_t r = read(fd, chunk.data(), chunk.size());
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                print_error("read() of replay script failed");
+                if (fd != 0) close(fd);
+                return false;
+            }
+            if (r == 0) break;
+            data.append(chunk.data(), r);
+        }
+        parse_replay_script(data.data(), data.size());
+    }
+    if (fd != 0) close(fd);
+
+    // Serializacja z góry: w pętli nie formatujemy już żadnych liczb.
+    replay_wire.reserve(replay_script.size() * 24);
+    replay_ends.reserve(replay_script.size());
+    char buf[128];
+    for (const replay_put &put : replay_script) {
+        int len = std::snprintf(buf, sizeof(buf), "PUT %d %.10g\r\n",
+                                put.point, put.value);
+        replay_wire.append(buf, len);
+        replay_ends.push_back(replay_wire.size());
     }
-    return res;
+    std::cout << player_id << " loaded " << replay_script.size()
+              << " PUTs (" << replay_wire.size() << " bytes) from "
+              << replay_path << ".\n";
+    return true;
+}
+
+// Ile PUT-ów powinno już wyjść, zgodnie z zadanym tempem.
+static size_t replay_due_puts(std::chrono::steady_clock::time_point now) {
+    size_t total = replay_ends.size();
+    if (replay_rate <= 0) return total;
+    double elapsed = std::chrono::duration<double>(now - replay_start).count();
+    double due = elapsed * replay_rate + 1;
+    return due >= static_cast<double>(total) ? total : static_cast<size_t>(due);
+}
+
+static bool replay_finished() {
+    return replay_sent_bytes == replay_wire.size();
+}
+
+// Wysyła zaległą część skryptu; zwraca false przy błędzie gniazda.
+static bool replay_pump(int sockfd) {
+    if (!coeff_received || replay_finished()) return true;
+    auto now = std::chrono::steady_clock::now();
+    size_t due = replay_due_puts(now);
+    size_t target = due == 0 ? 0 : replay_ends[due - 1];
+    replay_blocked = false;
+    while (replay_sent_bytes < target) {
+        size_t len = std::min(target - replay_sent_bytes, REPLAY_MAX_WRITE);
+        ssize_t sent = transport_send(sockfd,
+            replay_wire.data() + replay_sent_bytes, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EWOULDBLOCK || errno == EAGAIN) {
+                replay_blocked = true;
+                break;
+            }
+            print_error("Failed to send PUT command to server");
+            return false;
+        }
+        replay_sent_bytes += sent;
+    }
+    size_t sent_before = replay_sent_puts;
+    replay_sent_puts = std::upper_bound(replay_ends.begin(),
+        replay_ends.end(), replay_sent_bytes) - replay_ends.begin();
+    // PUT-y z tej porcji dostają wspólny znacznik czasu.
+    now = std::chrono::steady_clock::now();
+    for (size_t i = sent_before; i < replay_sent_puts; ++i) {
+        APPROX_PROBE3(put_send, sockfd, replay_script[i].point,
+                      probe_micro(replay_script[i].value));
+        track_put_sent(replay_script[i].point, replay_script[i].value, now);
+    }
+    if (replay_finished() && !replay_done_reported) {
+        replay_done_reported = true;
+        double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - replay_start).count();
+        std::cout << player_id << " replayed " << replay_sent_puts
+                  << " PUTs in " << secs << " s ("
+                  << (secs > 0 ? replay_sent_puts / secs : 0.0)
+                  << " PUT/s).\n";
+    }
+    return true;
+}
+
+// Timeout dla poll(): do chwili, w której wypada kolejny PUT.
+static int replay_poll_timeout() {
+    if (!coeff_received || replay_finished() || replay_blocked) return -1;
+    if (replay_rate <= 0) return 0;
+    auto now = std::chrono::steady_clock::now();
+    double next = static_cast<double>(replay_due_puts(now)) / replay_rate;
+    double wait = next - std::chrono::duration<double>(
+        now - replay_start).count();
+    return wait <= 0 ? 0 : static_cast<int>(wait * 1000) + 1;
 }
 
 // Zmieniona obsługa COEFF: parsuje coeffs i ustala auto_K
@@ -196,11 +740,13 @@ static void handle_coeff_line(const std::string &line, int sockfd) {
     std::istringstream iss(line.substr(6));
     double x;
     while (iss >> x) coeffs.push_back(x);
+    poly = &select_poly_kernels(static_cast<int>(coeffs.size()) - 1);
     std::cout << player_id << " get coefficients";
     for (double c : coeffs) std::cout << " " << c;
     std::cout << ".\n";
 
     coeff_received = true;
+    replay_start = std::chrono::steady_clock::now();
     auto_next_point = 0;
     auto_waiting_for_response = false;
     // auto_K: jeżeli nie wiadomo, to po pierwszym STATE rozpoznasz, na razie -1
@@ -222,6 +768,7 @@ static void handle_coeff_line(const std::string &line, int sockfd) {
 
 // Zmieniona obsługa STATE: zapamiętaj ile punktów (czyli auto_K)
 static void handle_state_line(const std::string &line) {
+    APPROX_PROBE2(state_recv, player_id.c_str(), line.size());
     current_state.clear();
     std::istringstream iss(line.substr(6));
     double v;
@@ -241,6 +788,22 @@ static void handle_penalty(const std::string &line) {
     auto_waiting_for_response = false;
 }
 
+// W trybie odtwarzania nie parsujemy ani nie wypisujemy każdej odpowiedzi
+// (przy setkach tysięcy PUT/s to by dominowało), tylko je zliczamy.
+static bool handle_replay_response(const std::string &line) {
+    if (line.rfind("STATE ", 0) == 0) {
+        APPROX_PROBE2(state_recv, player_id.c_str(), line.size());
+        replay_states++;
+    } else if (line.rfind("BAD_PUT ", 0) == 0) {
+        replay_bad_puts++;
+    } else if (line.rfind("PENALTY ", 0) == 0) {
+        replay_penalties++;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 static bool handle_scoring_line(const std::string &line, int sockfd) {
     // Parsujemy „SCORING pid1 res1 pid2 res2 ...”
     std::vector<std::pair<std::string,double>> results;
@@ -256,13 +819,20 @@ static bool handle_scoring_line(const std::string &line, int sockfd) {
         std::cout << " " << pr.first << " " << pr.second;
     }
     std::cout << ".\n";
+    report_client_latency();
+    if (replay_active()) {
+        std::cout << player_id << " replay summary: sent " << replay_sent_puts
+                  << " of " << replay_script.size() << " PUTs, received "
+                  << replay_states << " STATE, " << replay_bad_puts
+                  << " BAD_PUT, " << replay_penalties << " PENALTY.\n";
+    }
     close(sockfd);
     return false;  // sygnał do zakończenia pętli
 }
 
 static bool process_server_data(int sockfd) {
-    char buf[1024];
-    ssize_t recvd = recv(sockfd, buf, sizeof(buf), 0);
+    static char buf[65536];
+    ssize_t recvd = transport_recv(sockfd, buf, sizeof(buf));
     if (recvd < 0) {
         if (errno != EWOULDBLOCK && errno != EAGAIN) {
             print_error("recv() failed");
@@ -276,6 +846,7 @@ static bool process_server_data(int sockfd) {
         return false;
     }
     sock_buf.append(buf, recvd);
+    auto now = std::chrono::steady_clock::now();
 
     // Parsujemy linie zakończone "\r\n"
     while (true) {
@@ -284,6 +855,14 @@ static bool process_server_data(int sockfd) {
         std::string line = sock_buf.substr(0, pos);
         sock_buf.erase(0, pos + 2);
 
+        if (line.rfind("STATE ", 0) == 0) {
+            track_state(line, now);
+        } else if (line.rfind("BAD_PUT ", 0) == 0) {
+            track_rejection(line.substr(8), true, now);
+        } else if (line.rfind("PENALTY ", 0) == 0) {
+            track_rejection(line.substr(8), false, now);
+        }
+
         if (!coeff_received) {
             if (line.rfind("COEFF ", 0) == 0) {
                 handle_coeff_line(line, sockfd);
@@ -296,6 +875,8 @@ static bool process_server_data(int sockfd) {
                 close(sockfd);
                 return false;
             }
+        } else if (replay_active() && handle_replay_response(line)) {
+            continue;
         } else {
             if (line.rfind("STATE ", 0) == 0) {
                 handle_state_line(line);
@@ -365,21 +946,46 @@ static void client_loop(int sockfd) {
     flags = fcntl(sockfd, F_GETFL, 0);
     fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
 
-    struct pollfd fds[2];
-    fds[0].fd = 0;         // stdin
+    struct pollfd fds[3];
+    // stdin (ignorowane przy -r i -a; zamknięte stdin zgłaszałoby POLLIN
+    // bez przerwy)
+    fds[0].fd = (replay_active() || auto_mode) ? -1 : 0;
     fds[0].events = POLLIN;
-    fds[1].fd = sockfd;    // socket
+    fds[1].fd = sockfd;    // socket (przy -L tylko do wykrycia rozłączenia)
     fds[1].events = POLLIN;
+    fds[2].fd = local_wake_client;  // budzenie przez serwer (-L)
+    fds[2].events = POLLIN;
 
     while (true) {
-        int ret = poll(fds, 2, -1);
+        int timeout = -1;
+        fds[1].events = POLLIN;
+        if (replay_active()) {
+            timeout = replay_poll_timeout();
+            // Pełny pierścień nie zgłasza POLLOUT: sprawdzamy co 1 ms.
+            if (replay_blocked && local_channel != nullptr) timeout = 1;
+            else if (replay_blocked) fds[1].events |= POLLOUT;
+        }
+        if (local_channel != nullptr && timeout != 0 &&
+            !shm_ring_prepare_sleep(local_channel->to_client))
+            timeout = 0;
+        int ret = poll(fds, 3, timeout);
         if (ret < 0) {
             if (errno == EINTR) continue;
             print_error("poll() error");
             break;
         }
         // 1) Dane od serwera
-        if (fds[1].revents & POLLIN) {
+        if (local_channel != nullptr) {
+            if (fds[2].revents & POLLIN) shm_clear_eventfd(local_wake_client);
+            while (!shm_ring_empty(local_channel->to_client)) {
+                if (!process_server_data(sockfd)) return;
+            }
+            // Serwer zamknął gniazdo, a w pierścieniu nie było SCORING.
+            if (fds[1].revents != 0) {
+                print_error("ERROR: unexpected server disconnect");
+                return;
+            }
+        } else if (fds[1].revents & POLLIN) {
             if (!process_server_data(sockfd)) {
                 return;
             }
@@ -388,6 +994,10 @@ static void client_loop(int sockfd) {
         if (!auto_mode && (fds[0].revents & POLLIN)) {
             process_stdin_data(sockfd);
         }
+        // 3) Kolejna porcja skryptu (tryb -r)
+        if (replay_active() && !replay_pump(sockfd)) {
+            return;
+        }
         // --- AUTO_MODE STRATEGIA ---
         if (auto_mode && coeff_received && !auto_waiting_for_response && auto_K != -1 && auto_next_point <= auto_K) {
             // Wyślij PUT x f(x) saturowane do [-5,5]
@@ -406,8 +1016,9 @@ static void client_loop(int sockfd) {
 
 int main(int argc, char* argv[]) {
     if (!parse_arguments(argc, argv)) return 1;
+    if (replay_active() && !load_replay_script()) return 1;
 
-    int sockfd = connect_to_server();
+    int sockfd = local_path.empty() ? connect_to_server() : connect_local();
     if (sockfd < 0) return 1;
 
     if (!send_hello(sockfd)) {
@@ -0,0 +1,341 @@
+// Silnik gry: zasady HELLO, PUT, STATE i SCORING bez gniazd, bez
+// wypisywania i bez zmiennych globalnych.
+//
+// Graczy identyfikuje liczba nadana przez wywołującego (serwer używa
+// klucza połączenia). Czas też podaje wywołujący, więc ten sam kod
+// obsługuje pętlę sieciową, odtwarzanie dziennika i pomiary w jednym
+// procesie. Komunikaty protokołu składa i wysyła front sieciowy na
+// podstawie wyników zwracanych przez silnik.
+
+#ifndef APPROX_ENGINE_H
+#define APPROX_ENGINE_H
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "approx-poly.h"
+
+enum class State { AwaitingHello, AwaitingPut, WaitingForState };
+
+// Wartości funkcji aproksymującej klienta w punktach 0..K. Dopóki klient
+// dotknął niewielu punktów, trzymamy posortowaną listę (punkt, wartość);
+// gdy zajmie ona więcej niż 1/APPROX_DENSE_RATIO punktów, przechodzimy
+// na pełny wektor K + 1 wartości. Pamięć rośnie więc z liczbą PUT-ów,
+// a nie z liczbą połączeń razy K.
+class approx_store {
+public:
+    static constexpr int APPROX_DENSE_RATIO = 8;
+
+    void reset(int k) {
+        k_ = k;
+        sparse_.clear();
+        sparse_.shrink_to_fit();
+        dense_.clear();
+        dense_.shrink_to_fit();
+        is_dense_ = false;
+    }
+
+    // Przyjmuje pełny wektor K + 1 wartości (np. z migawki) i wybiera
+    // dla niego reprezentację.
+    void assign(const double *values, int k) {
+        reset(k);
+        size_t nonzero = std::count_if(values, values + k + 1,
+            [](double v) { return v != 0.0; });
+        if (nonzero * APPROX_DENSE_RATIO > static_cast<size_t>(k + 1)) {
+            dense_.assign(values, values + k + 1);
+            is_dense_ = true;
+            return;
+        }
+        sparse_.reserve(nonzero);
+        for (int x = 0; x <= k; ++x) {
+            if (values[x] != 0.0) sparse_.emplace_back(x, values[x]);
+        }
+    }
+
+    void add(int point, double val) {
+        if (is_dense_) {
+            dense_[point] += val;
+            return;
+        }
+        auto it = std::lower_bound(sparse_.begin(), sparse_.end(), point,
+            [](const std::pair<int, double> &e, int p) { return e.first < p; });
+        if (it != sparse_.end() && it->first == point) {
+            it->second += val;
+            return;
+        }
+        sparse_.insert(it, {point, val});
+        if (sparse_.size() * APPROX_DENSE_RATIO > static_cast<size_t>(k_ + 1))
+            promote();
+    }
+
+    // f(x, value) dla każdego x = from..to, po kolei.
+    template <typename F>
+    void for_each(int from, int to, F f) const {
+        if (is_dense_) {
+            for (int x = from; x <= to; ++x) f(x, dense_[x]);
+            return;
+        }
+        auto it = lower_bound(from);
+        for (int x = from; x <= to; ++x) {
+            if (it != sparse_.end() && it->first == x) {
+                f(x, it->second);
+                ++it;
+            } else {
+                f(x, 0.0);
+            }
+        }
+    }
+
+    // f(x, value) dla każdego x = 0..K, po kolei.
+    template <typename F>
+    void for_each(F f) const { for_each(0, k_, f); }
+
+    double at(int point) const {
+        if (is_dense_) return dense_[point];
+        auto it = lower_bound(point);
+        return it != sparse_.end() && it->first == point ? it->second : 0.0;
+    }
+
+    bool dense() const { return is_dense_; }
+    int k() const { return k_; }
+    const std::vector<std::pair<int, double>> &sparse() const {
+        return sparse_;
+    }
+    const std::vector<double> &values() const { return dense_; }
+
+    void load_sparse(int k, std::vector<std::pair<int, double>> entries) {
+        reset(k);
+        sparse_ = std::move(entries);
+    }
+    void load_dense(int k, std::vector<double> values) {
+        reset(k);
+        dense_ = std::move(values);
+        is_dense_ = true;
+    }
+
+private:
+    using sparse_iterator =
+        std::vector<std::pair<int, double>>::const_iterator;
+
+    sparse_iterator lower_bound(int point) const {
+        return std::lower_bound(sparse_.begin(), sparse_.end(), point,
+            [](const std::pair<int, double> &e, int p) { return e.first < p; });
+    }
+
+    void promote() {
+        dense_.assign(k_ + 1, 0.0);
+        for (const auto &[x, v] : sparse_) dense_[x] = v;
+        sparse_.clear();
+        sparse_.shrink_to_fit();
+        is_dense_ = true;
+    }
+
+    int k_{0};
+    std::vector<std::pair<int, double>> sparse_{};
+    std::vector<double> dense_{};
+    bool is_dense_{false};
+};
+
+// Stan jednego gracza w grze.
+struct approx_player {
+    std::string username{};
+    State state{State::AwaitingHello};
+    std::vector<double> coeffs{}; // a0..aN przydzielone w COEFF
+    approx_store approx{};
+    double penalty{0.0};
+    int puts_count{0};
+    int lowercase{0};             // opóźnienie STATE w sekundach
+    int sent_put{0};              // przyjęte PUT-y
+    bool has_pending{false};      // czy jest STATE do wysłania
+    // kiedy wysłać STATE
+    std::chrono::steady_clock::time_point send_time{};
+    // kiedy dotarł PUT, na który odpowiada STATE
+    std::chrono::steady_clock::time_point put_time{};
+};
+
+// Wynik PUT. Oba błędy mogą wystąpić naraz; przyjęty jest tylko PUT
+// bez żadnego z nich.
+struct put_outcome {
+    bool bad_put{false}; // punkt lub wartość poza zakresem (+10)
+    bool penalty{false}; // PUT przed HELLO (+20)
+
+    bool accepted() const { return !bad_put && !penalty; }
+};
+
+// Wynik gracza na koniec gry.
+struct player_result {
+    std::string username;
+    double score;
+    double penalty;
+    int puts;       // przyjęte PUT-y
+};
+
+class approx_engine {
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    static constexpr double MIN_VALUE = -5.0;
+    static constexpr double MAX_VALUE = 5.0;
+    static constexpr double BAD_PUT_PENALTY = 10;
+    static constexpr double EARLY_PUT_PENALTY = 20;
+
+    approx_engine() = default;
+    approx_engine(int k, int n) { configure(k, n); }
+
+    // Jądra wielomianu dla N wybieramy tu, raz na grę.
+    void configure(int k, int n) {
+        k_ = k;
+        n_ = n;
+        kernels_ = &select_poly_kernels(n);
+    }
+    int k() const { return k_; }
+    int n() const { return n_; }
+
+    // Nowe połączenie, jeszcze bez HELLO.
+    approx_player &open(int id) {
+        approx_player &p = players_[id];
+        p = approx_player{};
+        p.approx.reset(k_);
+        return p;
+    }
+
+    static bool valid_player_id(const std::string &name) {
+        if (name.empty()) return false;
+        for (char c : name) {
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                  (c >= 'A' && c <= 'Z')))
+                return false;
+        }
+        return true;
+    }
+
+    // HELLO. Zwraca false dla nieznanego gracza, powtórnego HELLO albo
+    // niepoprawnej nazwy. Współczynniki można też nadać później przez
+    // player(id).coeffs.
+    bool join(int id, const std::string &name,
+              std::vector<double> coeffs = {}) {
+        auto it = players_.find(id);
+        if (it == players_.end() || it->second.state != State::AwaitingHello ||
+            !valid_player_id(name))
+            return false;
+        approx_player &p = it->second;
+        p.username = name;
+        p.lowercase = static_cast<int>(std::count_if(name.begin(), name.end(),
+            [](char c) { return c >= 'a' && c <= 'z'; }));
+        p.coeffs = std::move(coeffs);
+        p.state = State::AwaitingPut;
+        return true;
+    }
+
+    // PUT w chwili `now`. Przyjęty PUT zmienia approx i planuje STATE
+    // za `lowercase` sekund; kolejne PUT-y przed jego wysłaniem łączą się
+    // w jeden STATE z bieżącym stanem.
+    put_outcome put(int id, int point, double value, time_point now) {
+        put_outcome out;
+        auto it = players_.find(id);
+        if (it == players_.end()) return out;
+        approx_player &p = it->second;
+        p.put_time = now;
+        if (point < 0 || point > k_ || value < MIN_VALUE ||
+            value > MAX_VALUE) {
+            p.penalty += BAD_PUT_PENALTY;
+            out.bad_put = true;
+        }
+        if (p.state != State::AwaitingPut) {
+            p.penalty += EARLY_PUT_PENALTY;
+            out.penalty = true;
+        }
+        if (!out.accepted()) return out;
+        p.sent_put++;
+        p.approx.add(point, value);
+        p.has_pending = true;
+        p.send_time = now + std::chrono::seconds(p.lowercase);
+        return out;
+    }
+
+    // Wywołuje emit(id, gracz) dla każdego STATE, którego czas nadszedł,
+    // w kolejności identyfikatorów, i oznacza go jako wysłany.
+    template <typename F>
+    void drain_due_states(time_point now, F &&emit) {
+        for (auto &[id, p] : players_) {
+            if (!p.has_pending || now < p.send_time) continue;
+            p.has_pending = false;
+            emit(id, static_cast<const approx_player&>(p));
+        }
+    }
+
+    // Najbliższy termin wysłania STATE; false, jeśli nic nie czeka.
+    bool next_due(time_point &t) const {
+        bool any = false;
+        for (const auto &[id, p] : players_) {
+            if (!p.has_pending) continue;
+            if (!any || p.send_time < t) t = p.send_time;
+            any = true;
+        }
+        return any;
+    }
+
+    // Gracz odchodzi; zwraca liczbę jego przyjętych PUT-ów.
+    int leave(int id) {
+        auto it = players_.find(id);
+        if (it == players_.end()) return 0;
+        int sent = it->second.sent_put;
+        players_.erase(it);
+        return sent;
+    }
+
+    // Wynik gracza: ∑_{x=0..K} (approx[x] – f(x))^2 + penalty.
+    // Gracz bez COEFF (nie było HELLO) ma f = 0 i liczy go ogólna pętla.
+    double score(const approx_player &p) const {
+        int deg = std::min<int>(n_, static_cast<int>(p.coeffs.size()) - 1);
+        const poly_kernels &kern =
+            deg == n_ ? *kernels_ : POLY_GENERAL_KERNELS;
+        const approx_store &a = p.approx;
+        double sum_squares = a.dense()
+            ? kern.sse_dense(p.coeffs.data(), deg, a.values().data(), a.k())
+            : kern.sse_sparse(p.coeffs.data(), deg, a.sparse().data(),
+                              a.sparse().size(), a.k());
+        return sum_squares + p.penalty;
+    }
+
+    // Wyniki wszystkich graczy, posortowane po nazwie (ASCII).
+    std::vector<player_result> results() const {
+        std::vector<player_result> out;
+        out.reserve(players_.size());
+        for (const auto &[id, p] : players_)
+            out.push_back({p.username, score(p), p.penalty, p.sent_put});
+        std::sort(out.begin(), out.end(),
+                  [](const player_result &a, const player_result &b) {
+                      return a.username < b.username;
+                  });
+        return out;
+    }
+
+    // Same pary (nazwa, wynik), w tej samej kolejności.
+    std::vector<std::pair<std::string, double>> score() const {
+        std::vector<std::pair<std::string, double>> results;
+        results.reserve(players_.size());
+        for (player_result &r : this->results())
+            results.emplace_back(std::move(r.username), r.score);
+        return results;
+    }
+
+    void clear() { players_.clear(); }
+
+    bool contains(int id) const { return players_.count(id) != 0; }
+    approx_player &player(int id) { return players_.at(id); }
+    const approx_player &player(int id) const { return players_.at(id); }
+    const std::map<int, approx_player> &players() const { return players_; }
+
+private:
+    int k_{100};
+    int n_{4};
+    const poly_kernels *kernels_{&select_poly_kernels(4)};
+    std::map<int, approx_player> players_{};
+};
+
+#endif
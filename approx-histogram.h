@@ -0,0 +1,48 @@
+// Histogram opóźnień używany przez serwer (--low-latency) i klienta
+// (czasy od PUT do odpowiedzi).
+
+#ifndef APPROX_HISTOGRAM_H
+#define APPROX_HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Histogram opóźnień w stylu HDR: kubełki logarytmiczne, każdy podzielony
+// liniowo na 2^SUB_BITS części, czyli ok. 6% błędu względnego.
+struct latency_histogram {
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB = 1 << SUB_BITS;
+    uint64_t counts[64 * SUB]{};
+    uint64_t total{0};
+    uint64_t max{0};
+
+    static int bucket(uint64_t ns) {
+        if (ns < SUB) return static_cast<int>(ns);
+        int msb = 63 - __builtin_clzll(ns);
+        int sub = static_cast<int>((ns >> (msb - SUB_BITS)) & (SUB - 1));
+        return (msb - SUB_BITS + 1) * SUB + sub;
+    }
+    static uint64_t bucket_value(int b) {
+        if (b < SUB) return b;
+        int msb = b / SUB + SUB_BITS - 1;
+        uint64_t sub = b % SUB;
+        return (uint64_t(1) << msb) | (sub << (msb - SUB_BITS));
+    }
+    void record(uint64_t ns) {
+        counts[bucket(ns)]++;
+        total++;
+        max = std::max(max, ns);
+    }
+    uint64_t percentile(double p) const {
+        uint64_t want = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+        uint64_t seen = 0;
+        for (int b = 0; b < 64 * SUB; ++b) {
+            seen += counts[b];
+            if (seen >= want && seen > 0) return bucket_value(b);
+        }
+        return max;
+    }
+};
+
+#endif
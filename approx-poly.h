@@ -0,0 +1,132 @@
+// Wartość wielomianu f(x) = a0 + a1*x + … + aN*x^N i suma kwadratów
+// błędów approx względem f, liczone schematem Hornera.
+//
+// Dla N = 1..POLY_MAX_DEGREE jądra są szablonami: współczynniki trafiają
+// do tablicy o stałym rozmiarze, a pętla po stopniu rozwija się w czasie
+// kompilacji. Wskaźnik do właściwego jądra wybiera się raz (po ustaleniu
+// N), a dla pozostałych stopni zostaje ogólna pętla.
+
+#ifndef APPROX_POLY_H
+#define APPROX_POLY_H
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+static constexpr int POLY_MAX_DEGREE = 8;
+
+template <int I>
+constexpr double horner_from(const double *a, double x, double acc) {
+    if constexpr (I < 0) {
+        (void)a;
+        (void)x;
+        return acc;
+    } else {
+        return horner_from<I - 1>(a, x, acc * x + a[I]);
+    }
+}
+
+template <int Deg>
+constexpr double horner(const double *a, double x) {
+    return horner_from<Deg - 1>(a, x, a[Deg]);
+}
+
+// Ogólna wersja; deg < 0 oznacza wielomian zerowy.
+inline double horner_general(const double *a, int deg, double x) {
+    if (deg < 0) return 0.0;
+    double acc = a[deg];
+    for (int i = deg - 1; i >= 0; --i) acc = acc * x + a[i];
+    return acc;
+}
+
+// ∑_{x=0..k} (values[x] – f(x))^2
+template <int Deg>
+double poly_sse_dense_fixed(const double *a, int, const double *values,
+    int k) {
+    std::array<double, Deg + 1> c{};
+    for (int i = 0; i <= Deg; ++i) c[i] = a[i];
+    double sum = 0.0;
+    for (int x = 0; x <= k; ++x) {
+        double diff = values[x] - horner<Deg>(c.data(), x);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline double poly_sse_dense_general(const double *a, int deg,
+    const double *values, int k) {
+    double sum = 0.0;
+    for (int x = 0; x <= k; ++x) {
+        double diff = values[x] - horner_general(a, deg, x);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+// To samo dla posortowanej listy (x, wartość); punktów spoza listy
+// dotyczy wartość 0. Kolejność sumowania jak w wersji gęstej.
+template <int Deg>
+double poly_sse_sparse_fixed(const double *a, int,
+    const std::pair<int, double> *points, size_t n, int k) {
+    std::array<double, Deg + 1> c{};
+    for (int i = 0; i <= Deg; ++i) c[i] = a[i];
+    double sum = 0.0;
+    size_t j = 0;
+    for (int x = 0; x <= k; ++x) {
+        double v = (j < n && points[j].first == x) ? points[j++].second : 0.0;
+        double diff = v - horner<Deg>(c.data(), x);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+inline double poly_sse_sparse_general(const double *a, int deg,
+    const std::pair<int, double> *points, size_t n, int k) {
+    double sum = 0.0;
+    size_t j = 0;
+    for (int x = 0; x <= k; ++x) {
+        double v = (j < n && points[j].first == x) ? points[j++].second : 0.0;
+        double diff = v - horner_general(a, deg, x);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <int Deg>
+double poly_eval_fixed(const double *a, int, double x) {
+    return horner<Deg>(a, x);
+}
+
+// Zestaw jąder dla jednego stopnia.
+struct poly_kernels {
+    int degree;
+    double (*eval)(const double *a, int deg, double x);
+    double (*sse_dense)(const double *a, int deg, const double *values,
+                        int k);
+    double (*sse_sparse)(const double *a, int deg,
+                         const std::pair<int, double> *points, size_t n,
+                         int k);
+};
+
+template <size_t... D>
+constexpr std::array<poly_kernels, sizeof...(D)>
+make_poly_kernel_table(std::index_sequence<D...>) {
+    return {{{static_cast<int>(D) + 1,
+              &poly_eval_fixed<static_cast<int>(D) + 1>,
+              &poly_sse_dense_fixed<static_cast<int>(D) + 1>,
+              &poly_sse_sparse_fixed<static_cast<int>(D) + 1>}...}};
+}
+
+static constexpr std::array<poly_kernels, POLY_MAX_DEGREE> POLY_KERNELS =
+    make_poly_kernel_table(std::make_index_sequence<POLY_MAX_DEGREE>{});
+
+static constexpr poly_kernels POLY_GENERAL_KERNELS = {
+    -1, &horner_general, &poly_sse_dense_general, &poly_sse_sparse_general};
+
+// Jądra dla stopnia `deg`; spoza 1..POLY_MAX_DEGREE ogólne.
+constexpr const poly_kernels &select_poly_kernels(int deg) {
+    return (deg >= 1 && deg <= POLY_MAX_DEGREE) ? POLY_KERNELS[deg - 1]
+                                                : POLY_GENERAL_KERNELS;
+}
+
+#endif
@@ -0,0 +1,60 @@
+// Statyczne punkty śledzenia USDT (dostawca "approx") dla bpftrace, perf
+// i SystemTap, np.:
+//
+//     bpftrace -l 'usdt:./approx-server:approx:*'
+//     bpftrace approx-latency.bt
+//
+// Z <sys/sdt.h> każdy punkt to jedna instrukcja nop i notatka w ELF,
+// którą narzędzie podmienia dopiero po podłączeniu się do procesu. Bez
+// tego nagłówka (albo z -DAPPROX_NO_PROBES) makra znikają razem
+// z argumentami.
+//
+// Argumenty są liczbami albo wskaźnikami na napisy C. Wartości PUT idą
+// w milionowych częściach (probe_micro), a czasy jako nanosekundy zegara
+// monotonicznego (probe_ns), tego samego co `nsecs` w bpftrace.
+
+#ifndef APPROX_PROBES_H
+#define APPROX_PROBES_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#if !defined(APPROX_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define APPROX_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef APPROX_HAVE_PROBES
+#define APPROX_PROBE1(name, a) DTRACE_PROBE1(approx, name, a)
+#define APPROX_PROBE2(name, a, b) DTRACE_PROBE2(approx, name, a, b)
+#define APPROX_PROBE3(name, a, b, c) DTRACE_PROBE3(approx, name, a, b, c)
+#define APPROX_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(approx, name, a, b, c, d)
+#define APPROX_PROBE5(name, a, b, c, d, e) \
+    DTRACE_PROBE5(approx, name, a, b, c, d, e)
+#else
+#define APPROX_PROBE1(name, a) ((void)0)
+#define APPROX_PROBE2(name, a, b) ((void)0)
+#define APPROX_PROBE3(name, a, b, c) ((void)0)
+#define APPROX_PROBE4(name, a, b, c, d) ((void)0)
+#define APPROX_PROBE5(name, a, b, c, d, e) ((void)0)
+#endif
+
+inline int64_t probe_ns(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t.time_since_epoch()).count();
+}
+
+// Wartość w milionowych, przycięta tak, żeby BAD_PUT z absurdalną
+// liczbą nie przepełnił int64.
+inline int64_t probe_micro(double v) {
+    constexpr double LIMIT = 9e12;
+    if (!(v > -LIMIT)) return static_cast<int64_t>(-LIMIT);
+    if (!(v < LIMIT)) return static_cast<int64_t>(LIMIT);
+    return static_cast<int64_t>(std::llround(v * 1e6));
+}
+
+#endif
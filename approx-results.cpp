@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "approx-results.h"
+
+// Zapytania do pliku wyników serwera (--results): ranking graczy
+// i statystyki pojedynczego gracza. Plik jest mapowany w całości, a każdy
+// blok przeglądamy kolumnami: filtr gier to jedna pętla po kolumnach gier,
+// potem jedna pętla po wierszach dokłada wyniki do tablic sum indeksowanych
+// globalnym numerem gracza (słownik bloku tłumaczymy raz na blok).
+
+std::string path{};
+int top = 10;
+std::string order = "mean";
+int min_games = 1;
+std::string player{};
+int filter_k = -1;
+int filter_n = -1;
+int64_t since_ns = std::numeric_limits<int64_t>::min();
+int64_t until_ns = std::numeric_limits<int64_t>::max();
+
+static void print_error(const std::string& msg) {
+    std::cerr << "ERROR: " << msg << "\n";
+}
+
+static bool parse_arguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-f" && i + 1 < argc) {
+            path = argv[++i];
+        } else if (arg == "-t" && i + 1 < argc) {
+            top = std::atoi(argv[++i]);
+            if (top < 1) {
+                print_error("Invalid value for -t (top)");
+                return false;
+            }
+        } else if (arg == "-b" && i + 1 < argc) {
+            order = argv[++i];
+            if (order != "mean" && order != "best" && order != "wins" &&
+                order != "games") {
+                print_error("Invalid value for -b (mean|best|wins|games)");
+                return false;
+            }
+        } else if (arg == "-g" && i + 1 < argc) {
+            min_games = std::atoi(argv[++i]);
+            if (min_games < 1) {
+                print_error("Invalid value for -g (min games)");
+                return false;
+            }
+        } else if (arg == "-u" && i + 1 < argc) {
+            player = argv[++i];
+        } else if (arg == "-k" && i + 1 < argc) {
+            filter_k = std::atoi(argv[++i]);
+        } else if (arg == "-n" && i + 1 < argc) {
+            filter_n = std::atoi(argv[++i]);
+        } else if (arg == "--since" && i + 1 < argc) {
+            since_ns = std::atoll(argv[++i]) * 1000000000LL;
+        } else if (arg == "--until" && i + 1 < argc) {
+            until_ns = std::atoll(argv[++i]) * 1000000000LL;
+        } else {
+            print_error("Unknown or incomplete argument: " + arg);
+            return false;
+        }
+    }
+    if (path.empty()) {
+        print_error("Missing -f (results file)");
+        return false;
+    }
+    return true;
+}
+
+// Sumy na gracza, jako osobne tablice indeksowane numerem gracza.
+struct player_totals {
+    std::vector<std::string> names;
+    std::vector<uint32_t> games;
+    std::vector<uint32_t> wins;
+    std::vector<double> score_sum;
+    std::vector<double> best;
+    std::vector<double> penalty;
+    std::vector<uint64_t> puts;
+    std::unordered_map<std::string, uint32_t> ids;
+
+    uint32_t id(const char *name, size_t len) {
+        auto [it, fresh] = ids.try_emplace(std::string(name, len),
+            static_cast<uint32_t>(names.size()));
+        if (fresh) {
+            names.push_back(it->first);
+            games.push_back(0);
+            wins.push_back(0);
+            score_sum.push_back(0.0);
+            best.push_back(std::numeric_limits<double>::infinity());
+            penalty.push_back(0.0);
+            puts.push_back(0);
+        }
+        return it->second;
+    }
+};
+
+struct scan_stats {
+    uint64_t blocks = 0;
+    uint64_t games = 0;   // gry spełniające filtr
+    uint64_t rows = 0;
+    uint64_t torn_bytes = 0;
+};
+
+template <typename T>
+static const T *column(const char *block, size_t offset) {
+    return reinterpret_cast<const T*>(block + offset);
+}
+
+// Rozmiar bloku zgadza się z układem, ale indeksy w kolumnach też
+// pochodzą z pliku. Blok, w którym wskazują poza swoje tablice,
+// traktujemy jak urwany.
+static bool block_sane(const char *block, const results_block_header &hdr) {
+    results_block_layout l = results_layout(hdr.games, hdr.rows, hdr.names,
+                                            hdr.name_bytes);
+    const uint32_t *row_game = column<uint32_t>(block, l.row_game);
+    const uint32_t *row_name = column<uint32_t>(block, l.row_name);
+    const uint32_t *name_off = column<uint32_t>(block, l.name_offsets);
+    uint32_t bad = 0;
+    for (uint32_t r = 0; r < hdr.rows; ++r)
+        bad |= (row_game[r] >= hdr.games) | (row_name[r] >= hdr.names);
+    for (uint32_t i = 0; i < hdr.names; ++i)
+        bad |= name_off[i] > name_off[i + 1];
+    return !bad && name_off[hdr.names] <= hdr.name_bytes;
+}
+
+static void scan_block(const char *block, const results_block_header &hdr,
+    player_totals &totals, scan_stats &stats) {
+    results_block_layout l = results_layout(hdr.games, hdr.rows, hdr.names,
+                                            hdr.name_bytes);
+    const int64_t *start = column<int64_t>(block, l.game_start);
+    const int32_t *k = column<int32_t>(block, l.game_k);
+    const int32_t *n = column<int32_t>(block, l.game_n);
+    const uint32_t *row_game = column<uint32_t>(block, l.row_game);
+    const uint32_t *row_name = column<uint32_t>(block, l.row_name);
+    const double *score = column<double>(block, l.row_score);
+    const double *penalty = column<double>(block, l.row_penalty);
+    const int32_t *puts = column<int32_t>(block, l.row_puts);
+    const uint32_t *name_off = column<uint32_t>(block, l.name_offsets);
+    const char *name_data = block + l.name_data;
+
+    // Filtr gier bez rozgałęzień, po całych kolumnach.
+    std::vector<uint8_t> keep(hdr.games);
+    int32_t any_k = filter_k < 0, any_n = filter_n < 0;
+    for (uint32_t g = 0; g < hdr.games; ++g) {
+        keep[g] = (any_k | (k[g] == filter_k)) & (any_n | (n[g] == filter_n)) &
+                  (start[g] >= since_ns) & (start[g] < until_ns);
+    }
+    for (uint32_t g = 0; g < hdr.games; ++g) stats.games += keep[g];
+
+    std::vector<uint32_t> ids(hdr.names);
+    for (uint32_t i = 0; i < hdr.names; ++i) {
+        ids[i] = totals.id(name_data + name_off[i],
+                           name_off[i + 1] - name_off[i]);
+    }
+
+    // Najlepszy (najniższy) wynik każdej gry, do liczenia zwycięstw.
+    std::vector<double> game_best(hdr.games,
+                                  std::numeric_limits<double>::infinity());
+    for (uint32_t r = 0; r < hdr.rows; ++r) {
+        double &b = game_best[row_game[r]];
+        b = std::min(b, score[r]);
+    }
+
+    for (uint32_t r = 0; r < hdr.rows; ++r) {
+        uint32_t g = row_game[r];
+        if (!keep[g]) continue;
+        uint32_t p = ids[row_name[r]];
+        totals.games[p]++;
+        totals.wins[p] += score[r] == game_best[g];
+        totals.score_sum[p] += score[r];
+        totals.best[p] = std::min(totals.best[p], score[r]);
+        totals.penalty[p] += penalty[r];
+        totals.puts[p] += puts[r];
+        stats.rows++;
+    }
+    stats.blocks++;
+}
+
+// Przegląda wszystkie pełne bloki; urwany koniec pliku tylko liczy.
+static bool scan_file(const char *data, size_t size, player_totals &totals,
+    scan_stats &stats) {
+    results_file_header fh{};
+    if (size < sizeof(fh)) {
+        print_error("Results file too short: " + path);
+        return false;
+    }
+    memcpy(&fh, data, sizeof(fh));
+    if (memcmp(fh.magic, RESULTS_MAGIC, sizeof(fh.magic)) != 0 ||
+        fh.version != RESULTS_VERSION) {
+        print_error("Invalid results file header: " + path);
+        return false;
+    }
+    size_t off = sizeof(fh);
+    while (size - off >= sizeof(results_block_header)) {
+        results_block_header hdr{};
+        memcpy(&hdr, data + off, sizeof(hdr));
+        if (memcmp(hdr.magic, RESULTS_BLOCK_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.size > size - off ||
+            hdr.size != results_layout(hdr.games, hdr.rows, hdr.names,
+                                       hdr.name_bytes).size ||
+            !block_sane(data + off, hdr))
+            break;
+        scan_block(data + off, hdr, totals, stats);
+        off += hdr.size;
+    }
+    stats.torn_bytes = size - off;
+    return true;
+}
+
+static void print_player(size_t rank, const player_totals &t, uint32_t p) {
+    std::printf("%4zu  %-20s %7u %6u %14.6g %14.6g %10.6g %10llu\n", rank,
+                t.names[p].c_str(), t.games[p], t.wins[p],
+                t.score_sum[p] / t.games[p], t.best[p], t.penalty[p],
+                static_cast<unsigned long long>(t.puts[p]));
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_arguments(argc, argv)) return 1;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        print_error("Cannot open results file: " + path);
+        return 1;
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    const char *data = nullptr;
+    if (size > 0) {
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            print_error("mmap() of results file failed");
+            close(fd);
+            return 1;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(map);
+    }
+    close(fd);
+
+    player_totals totals;
+    scan_stats stats;
+    auto t0 = std::chrono::steady_clock::now();
+    if (!scan_file(data, size, totals, stats)) return 1;
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+
+    std::cout << stats.games << " games, " << stats.rows << " results, "
+              << totals.names.size() << " players in " << stats.blocks
+              << " blocks, scanned in " << secs << " s";
+    if (stats.torn_bytes > 0)
+        std::cout << " (" << stats.torn_bytes << " bytes of a torn block)";
+    std::cout << ".\n";
+    std::printf("%4s  %-20s %7s %6s %14s %14s %10s %10s\n", "rank", "player",
+                "games", "wins", "mean", "best", "penalty", "puts");
+
+    if (!player.empty()) {
+        auto it = totals.ids.find(player);
+        if (it == totals.ids.end() || totals.games[it->second] == 0) {
+            std::cout << "No results for " << player << ".\n";
+            return 1;
+        }
+        print_player(1, totals, it->second);
+        return 0;
+    }
+
+    std::vector<uint32_t> ranked;
+    for (uint32_t p = 0; p < totals.names.size(); ++p) {
+        if (totals.games[p] >= static_cast<uint32_t>(min_games))
+            ranked.push_back(p);
+    }
+    // Niższy wynik jest lepszy; przy remisie decyduje nazwa.
+    auto better = [&totals](uint32_t a, uint32_t b) {
+        auto key = [&totals](uint32_t p) {
+            if (order == "best") return totals.best[p];
+            if (order == "wins") return -static_cast<double>(totals.wins[p]);
+            if (order == "games") return -static_cast<double>(totals.games[p]);
+            return totals.score_sum[p] / totals.games[p];
+        };
+        double ka = key(a), kb = key(b);
+        if (ka != kb) return ka < kb;
+        return totals.names[a] < totals.names[b];
+    };
+    size_t shown = std::min<size_t>(top, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+                      better);
+    for (size_t i = 0; i < shown; ++i) print_player(i + 1, totals, ranked[i]);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Plik wyników gier: serwer dopisuje (--results), approx-results czyta.
+//
+// Po nagłówku pliku leżą bloki, każdy z wynikami kilkudziesięciu gier,
+// dopisywane w całości jednym write() przez wątek zapisujący serwera.
+// Blok jest kolumnowy: najpierw kolumny gier (czasy, K, N, M, liczba
+// graczy), potem kolumny wierszy (wiersz to wynik jednego gracza w jednej
+// grze) i na końcu słownik nazw graczy z tego bloku. Każda kolumna zaczyna
+// się pod adresem wyrównanym do 8 bajtów, więc po mmap() całego pliku
+// czytnik dostaje gotowe tablice i przegląda je prostymi pętlami.
+//
+// Bloków nie nadpisujemy. Urwany ostatni blok (awaria w trakcie zapisu)
+// czytnik pomija, a serwer przy otwarciu pliku go odcina.
+
+#ifndef APPROX_RESULTS_H
+#define APPROX_RESULTS_H
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr char RESULTS_MAGIC[4] = {'A', 'P', 'X', 'R'};
+static constexpr char RESULTS_BLOCK_MAGIC[4] = {'A', 'P', 'X', 'B'};
+static constexpr uint32_t RESULTS_VERSION = 1;
+
+struct results_file_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t reserved;
+};
+static_assert(sizeof(results_file_header) == 16, "results header layout");
+
+struct results_block_header {
+    char magic[4];
+    uint32_t games;
+    uint32_t rows;
+    uint32_t names;       // wpisy w słowniku nazw bloku
+    uint64_t name_bytes;
+    uint64_t size;        // cały blok razem z nagłówkiem
+};
+static_assert(sizeof(results_block_header) == 32, "results block layout");
+
+// Położenie kolumn względem początku bloku:
+//   gry:     int64 start_ns, int64 end_ns (czas systemowy, ns od epoki),
+//            int32 k, int32 n, int32 m, uint32 players
+//   wiersze: uint32 game (indeks gry w bloku), uint32 name (indeks
+//            w słowniku), double score, double penalty, int32 puts
+//            (przyjęte PUT-y)
+//   nazwy:   uint32 name_offsets[names + 1], char name_data[name_bytes]
+struct results_block_layout {
+    size_t game_start, game_end, game_k, game_n, game_m, game_players;
+    size_t row_game, row_name, row_score, row_penalty, row_puts;
+    size_t name_offsets, name_data;
+    size_t size;
+};
+
+inline results_block_layout results_layout(uint32_t games, uint32_t rows,
+    uint32_t names, uint64_t name_bytes) {
+    results_block_layout l{};
+    size_t off = sizeof(results_block_header);
+    auto column = [&off](size_t bytes) {
+        size_t at = off;
+        off = (off + bytes + 7) & ~static_cast<size_t>(7);
+        return at;
+    };
+    l.game_start = column(sizeof(int64_t) * games);
+    l.game_end = column(sizeof(int64_t) * games);
+    l.game_k = column(sizeof(int32_t) * games);
+    l.game_n = column(sizeof(int32_t) * games);
+    l.game_m = column(sizeof(int32_t) * games);
+    l.game_players = column(sizeof(uint32_t) * games);
+    l.row_game = column(sizeof(uint32_t) * rows);
+    l.row_name = column(sizeof(uint32_t) * rows);
+    l.row_score = column(sizeof(double) * rows);
+    l.row_penalty = column(sizeof(double) * rows);
+    l.row_puts = column(sizeof(int32_t) * rows);
+    l.name_offsets = column(sizeof(uint32_t) *
+                            (static_cast<size_t>(names) + 1));
+    l.name_data = column(name_bytes);
+    l.size = off;
+    return l;
+}
+
+#endif
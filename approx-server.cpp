@@ -2,6 +2,7 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include <set>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <vector>
@@ -15,61 +16,1130 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <new>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <malloc.h>
+#include <cmath>
+#include <charconv>
+#include <sys/eventfd.h>
+
+#include "approx-engine.h"
+#include "approx-histogram.h"
+#include "approx-probes.h"
+#include "approx-results.h"
+#include "approx-shm.h"
 
 
 #define TIMEOUT 3
 
-enum class State { AwaitingHello, AwaitingPut, WaitingForState };
+// Wiadro żetonów do ograniczania tempa klienta: uzupełnia się
+// z prędkością `rate` na sekundę, do pojemności jednej sekundy.
+struct token_bucket {
+    double tokens{0.0};
+    std::chrono::steady_clock::time_point last{};
 
+    void refill(double rate, std::chrono::steady_clock::time_point now) {
+        double dt = std::chrono::duration<double>(now - last).count();
+        tokens = std::min(rate, tokens + dt * rate);
+        last = now;
+    }
+    // Ile milisekund do uzbierania pełnego żetonu.
+    int ms_to_token(double rate) const {
+        if (tokens >= 1.0) return 0;
+        return static_cast<int>((1.0 - tokens) / rate * 1000.0) + 1;
+    }
+};
+
+// Bufor wiadomości współdzielony przez kolejki wyjściowe klientów
+// (np. jeden SCORING dla wszystkich). Żyje, dopóki jest w kolejce
+// albo dopóki jądro nie zgłosi końca wysyłki zero-copy.
+using shared_buffer = std::shared_ptr<const std::string>;
+
+// STATE kodowany kawałkami prosto z approx gracza (next_state_chunk).
+struct state_stream {
+    int key{-1};     // gracz w `engine`
+    int next{0};     // pierwszy punkt jeszcze nie zakodowany
+    int last{0};     // K gracza
+    // Wartości z chwili wysłania dla punktów, które PUT zmienił, zanim
+    // kursor do nich doszedł; posortowane po punkcie.
+    std::vector<std::pair<int, double>> overrides{};
+    bool done() const { return next > last; }
+};
+
+struct outbound_segment {
+    shared_buffer data;
+    size_t offset{0};
+    // Niedokończony STATE: `data` to jego bieżący kawałek, a po wysłaniu
+    // go w całości w to samo miejsce wchodzi kolejny.
+    std::unique_ptr<state_stream> stream{};
+};
+
+// Wywołanie sendmsg(MSG_ZEROCOPY) czekające na potwierdzenie jądra.
+struct zerocopy_pending {
+    uint32_t seq;
+    std::vector<shared_buffer> buffers;
+};
+
+// Strona sieciowa połączenia; stan gry gracza trzyma `engine` pod tym
+// samym kluczem.
 struct client_info {
-    std::string username{};
     // Czas połączenia z klientem.
     std::chrono::steady_clock::time_point connect_time{};
     int socket_fd{-1};
     sockaddr_storage addr{};
-    std::string addr_text{}; // Wersja tekstowa do logów.
-    State state{State::AwaitingHello};
-    std::vector<double> coeffs{};
-    std::vector<double> approx{};
-    double penalty{0.0};
-    int puts_count{0};
+    mutable std::string addr_text{}; // Do logów, przez client_name().
     std::string net_buffer{};
-    int lowercase{0};
-    int sent_put{};
-    // treść odpowiedzi, którą musimy wysłać
-    std::string pending_response{};
-    // kiedy wysłać pending_response
-    std::chrono::steady_clock::time_point send_time{};
-    bool has_pending{false}; // czy jest odpowiedź do wysłania
+    std::deque<outbound_segment> outbound{}; // jeszcze nie wysłane
+    std::deque<zerocopy_pending> zc_inflight{};
+    uint32_t zc_seq{0};      // numer kolejnego wywołania zero-copy
+    bool zerocopy{false};    // SO_ZEROCOPY włączone na gnieździe
+    bool zerocopy_probed{false}; // próba włączenia już była
+    token_bucket byte_bucket{}; // --byte-rate
+    token_bucket msg_bucket{};  // --msg-rate
+    int checkpoint_slot{-1};  // slot w pliku migawki (-c)
+    bool checkpoint_dirty{false}; // zmiany od ostatniej migawki
+    // Klient lokalny (-L): socket_fd to eventfd budzący serwer, a dane
+    // płyną przez pierścienie w pamięci współdzielonej.
+    shm_channel *shm{nullptr};
+    int shm_ctrl_fd{-1};  // gniazdo uniksowe, tylko do wykrycia rozłączenia
+    int shm_memfd{-1};
+    int shm_wake_fd{-1};  // eventfd budzący klienta
+    bool spectator{false};   // widz (SPECTATE), nie gracz
+    uint64_t spectator_skips{0}; // ile razy zgubił zaległe zdarzenia
+    bool backlog{false};     // pełne linie czekają na kolejny obrót pętli
+    bool shm_broken{false};  // klient lokalny zepsuł liczniki pierścienia
     client_info() = default;
 
 };
 
 std::map<int, client_info> clients; // Mapa znanych nam klientów.
+approx_engine engine;               // Zasady gry i stan graczy.
 int port = 0;
 int K = 100;
 int N = 4;
 int M = 131;
 int currM = 131;
+// Górna granica -k. STATE idzie kawałkami, ale slot migawki, ranking
+// dla widzów i końcowy drain_outbound (1 s na SCORING) są O(K) na gracza;
+// przy tej granicy STATE ma najwyżej ~1 MB, a slot migawki 800 KB.
+static constexpr int K_MAX = 100000;
+// Powyżej tego K log nie wypisuje całego stanu przy każdym PUT i STATE.
+static constexpr int LOG_STATE_MAX_K = 10000;
 std::string filename{};
+std::string journal_path{};   // -j: plik dziennika zdarzeń
+std::string replay_path{};    // -r: dziennik do odtworzenia
+bool replay_paced = false;    // -P: odtwarzanie w nagranym tempie
+std::string checkpoint_path{}; // -c: plik migawki stanu gry
+int checkpoint_interval_ms = 1000; // -C: odstęp między migawkami
+bool resume = false;           // --resume: wznowienie gry z migawki
+// -k, -n, -m podane jawnie: przy --resume muszą zgadzać się z migawką.
+static bool k_given = false, n_given = false, m_given = false;
+int inherit_fd = -1;           // --inherit: gniazdo od poprzednika
+bool handover_listen_only = false; // --handover-listen-only
+std::string server_binary{};   // -U: plik wykonywalny następcy
+std::vector<std::string> server_args{}; // argumenty do ponownego exec
+double byte_rate = 0;          // --byte-rate: bajty/s na klienta (0 = bez limitu)
+double msg_rate = 0;           // --msg-rate: komunikaty/s na klienta
+size_t max_line = 1024;        // --max-line: najdłuższa linia od klienta
+size_t zerocopy_threshold = 64 * 1024; // --zerocopy: próg MSG_ZEROCOPY (0 = wył.)
+bool low_latency = false;      // --low-latency: pętla aktywnie czekająca
+int pin_cpu = -1;              // --cpu: rdzeń dla pętli zdarzeń
+std::string local_path{};      // -L: gniazdo uniksowe dla klientów lokalnych
+int local_listen_fd = -1;
+std::map<int, int> local_ctrl_owner; // gniazdo kontrolne -> klucz klienta
+int spectator_interval_ms = 1000; // --spectator-interval: co ile LEADERBOARD
+size_t spectator_backlog = 256;   // --spectator-backlog: limit kolejki widza
+int tick_msg_budget = 32;         // --tick-msgs: linie na klienta w obrocie
+size_t tick_byte_budget = 4096;   // --tick-bytes: bajty na klienta w obrocie
+std::vector<char> recv_buffer;    // tick_byte_budget bajtów na jeden odczyt
+std::string results_path{};       // --results: plik wyników gier
+int results_batch = 64;           // --results-batch: gier w jednym bloku
 
 
 static void print_error(const std::string& msg) {
     std::cerr << "ERROR: " << msg << std::endl;
 }
 
+// ---------------------------------------------------------------------
+// Binarny dziennik zdarzeń (-j) i jego deterministyczne odtwarzanie (-r)
+// ---------------------------------------------------------------------
+
+enum class FsyncPolicy { None, Batch, Interval };
+static FsyncPolicy journal_fsync = FsyncPolicy::Interval; // -J
+
+enum class JournalEvent : uint8_t {
+    Connect = 1,    // payload: adres klienta
+    Hello = 2,      // payload: linia HELLO
+    Coeff = 3,      // payload: linia COEFF
+    Put = 4,        // payload: linia PUT
+    BadPut = 5,
+    Penalty = 6,
+    StateSent = 7,
+    Disconnect = 8,
+    Scoring = 9,    // payload: linia SCORING
+};
+
+static constexpr char JOURNAL_MAGIC[4] = {'A', 'P', 'X', 'J'};
+static constexpr uint32_t JOURNAL_VERSION = 2;
+
+struct journal_file_header {
+    char magic[4];
+    uint32_t version;
+    int32_t k, n, m;
+    uint32_t reserved;
+    int64_t wall_start_ns;  // czas systemowy początku nagrania
+};
+static_assert(sizeof(journal_file_header) == 32, "journal header layout");
+
+// Każdy rekord to stały nagłówek i opcjonalnie `len` bajtów treści.
+// Treść to cała linia (--max-line bywa większe niż 64 KiB, SCORING też),
+// więc długość ma 32 bity.
+struct journal_record {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t reserved1;
+    int32_t fd;
+    int64_t ts_ns;          // czas monotoniczny od początku nagrania
+    int32_t point;
+    uint32_t len;
+    double value;
+};
+static_assert(sizeof(journal_record) == 32, "journal record layout");
+
+// Zegar serwera. Przy odtwarzaniu zwraca czas wirtualny wzięty
+// z dziennika, dzięki czemu opóźnienia STATE i TIMEOUT HELLO
+// zachowują się dokładnie tak jak w nagraniu.
+static bool replaying = false;
+static std::chrono::steady_clock::time_point replay_clock{};
+
+static std::chrono::steady_clock::time_point server_now() {
+    return replaying ? replay_clock : std::chrono::steady_clock::now();
+}
+
+// Zapis odbywa się w osobnym wątku: pętla zdarzeń tylko dopisuje rekordy
+// do lokalnego bufora i raz na obrót pętli przekazuje go writerowi.
+struct journal_writer {
+    int fd{-1};
+    std::chrono::steady_clock::time_point start{};
+    std::vector<char> local{};       // używany tylko przez pętlę zdarzeń
+    std::vector<char> queued{};      // chroniony przez mutex
+    std::mutex mutex{};
+    std::condition_variable cv{};
+    bool stop{false};
+    std::thread thread{};
+};
+
+static journal_writer journal;
+
+static bool journal_enabled() {
+    return journal.fd != -1;
+}
+
+static void journal_write_all(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t w = write(journal.fd, data, size);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            print_error("Błąd zapisu dziennika " + journal_path);
+            return;
+        }
+        data += w;
+        size -= w;
+    }
+}
+
+static void journal_thread_main() {
+    std::vector<char> batch;
+    auto last_sync = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(journal.mutex);
+    while (true) {
+        journal.cv.wait_for(lock, std::chrono::milliseconds(100), [] {
+            return journal.stop || !journal.queued.empty();
+        });
+        batch.swap(journal.queued);
+        bool stopping = journal.stop;
+        lock.unlock();
+        if (!batch.empty()) {
+            journal_write_all(batch.data(), batch.size());
+            batch.clear();
+            auto t = std::chrono::steady_clock::now();
+            if (journal_fsync == FsyncPolicy::Batch ||
+                (journal_fsync == FsyncPolicy::Interval &&
+                 t - last_sync >= std::chrono::seconds(1))) {
+                fdatasync(journal.fd);
+                last_sync = t;
+            }
+        }
+        if (stopping) {
+            if (journal_fsync != FsyncPolicy::None) fdatasync(journal.fd);
+            return;
+        }
+        lock.lock();
+    }
+}
+
+// Z append == true dopisuje do istniejącego dziennika (po przekazaniu
+// gniazd nowemu procesowi) bez ponownego zapisu nagłówka.
+static bool journal_open(bool append = false) {
+    journal.fd = open(journal_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC |
+        (append ? O_APPEND : O_TRUNC), 0644);
+    if (journal.fd < 0) {
+        print_error("Nie udało się otworzyć dziennika: " + journal_path);
+        return false;
+    }
+    journal.start = server_now();
+    journal.stop = false;
+    if (append) {
+        journal.thread = std::thread(journal_thread_main);
+        return true;
+    }
+    journal_file_header hdr{};
+    memcpy(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+    hdr.version = JOURNAL_VERSION;
+    hdr.k = K;
+    hdr.n = N;
+    hdr.m = M;
+    hdr.wall_start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    journal_write_all(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    journal.thread = std::thread(journal_thread_main);
+    return true;
+}
+
+static void journal_event(JournalEvent type, int fd, int point = 0,
+    double value = 0.0, const std::string &payload = std::string()) {
+    if (!journal_enabled()) return;
+    journal_record rec{};
+    rec.type = static_cast<uint8_t>(type);
+    rec.len = static_cast<uint32_t>(payload.size());
+    rec.fd = fd;
+    rec.ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        server_now() - journal.start).count();
+    rec.point = point;
+    rec.value = value;
+    const char *raw = reinterpret_cast<const char*>(&rec);
+    journal.local.insert(journal.local.end(), raw, raw + sizeof(rec));
+    journal.local.insert(journal.local.end(),
+        payload.data(), payload.data() + rec.len);
+}
+
+// Wywoływane raz na obrót pętli zdarzeń.
+static void journal_flush() {
+    if (!journal_enabled() || journal.local.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(journal.mutex);
+        if (journal.queued.empty()) {
+            journal.queued.swap(journal.local);
+        } else {
+            journal.queued.insert(journal.queued.end(),
+                journal.local.begin(), journal.local.end());
+            journal.local.clear();
+        }
+    }
+    journal.cv.notify_one();
+}
+
+static void journal_close() {
+    if (!journal_enabled()) return;
+    journal_flush();
+    {
+        std::lock_guard<std::mutex> lock(journal.mutex);
+        journal.stop = true;
+    }
+    journal.cv.notify_one();
+    journal.thread.join();
+    close(journal.fd);
+    journal.fd = -1;
+}
+
+// ---------------------------------------------------------------------
+// Wysyłanie: kolejka wyjściowa klienta, sendmsg z wieloma fragmentami
+// i MSG_ZEROCOPY dla dużych wiadomości
+// ---------------------------------------------------------------------
+
+// Wszystko, co idzie do klienta, trafia do jego kolejki wyjściowej jako
+// współdzielone bufory; flush_outbound składa je w jedno sendmsg (nagłówek,
+// treść i "\r\n" bez sklejania), a resztę dosyła, gdy gniazdo zgłosi
+// POLLOUT. Powyżej zerocopy_threshold bajtów wysyłamy z MSG_ZEROCOPY
+// i trzymamy bufory do potwierdzenia z kolejki błędów gniazda.
+
+// STATE nie powstaje w całości: w kolejce stoi segment z kursorem,
+// a kolejny kawałek (około STATE_CHUNK bajtów) kodujemy z approx gracza
+// dopiero, gdy poprzedni wyszedł do gniazda. Czekający STATE zajmuje więc
+// O(STATE_CHUNK) pamięci niezależnie od K.
+static constexpr size_t STATE_CHUNK = 64 * 1024;
+static constexpr int STATE_CHUNK_STEP = 1024; // punktów na przejście
+// Tyle kawałków najwyżej kodujemy w jednym flush_outbound; resztę dośle
+// kolejny POLLOUT, żeby długi STATE nie blokował pętli innym klientom.
+static constexpr int STATE_CHUNKS_PER_FLUSH = 4;
+
+static shared_buffer next_state_chunk(state_stream &s) {
+    const approx_store &approx = engine.player(s.key).approx;
+    auto chunk = std::make_shared<std::string>();
+    std::string &out = *chunk;
+    out.reserve(STATE_CHUNK + 16 * STATE_CHUNK_STEP);
+    if (s.next == 0) out += "STATE";
+    auto &ov = s.overrides;
+    auto oi = ov.begin();
+    while (!s.done() && out.size() < STATE_CHUNK) {
+        int to = std::min(s.last, s.next + STATE_CHUNK_STEP - 1);
+        approx.for_each(s.next, to, [&](int x, double v) {
+            if (oi != ov.end() && oi->first == x) v = (oi++)->second;
+            // Jak `ostream << double` (%g), tylko bez strumienia.
+            char buf[32];
+            buf[0] = ' ';
+            char *end = std::to_chars(buf + 1, buf + sizeof(buf), v,
+                                      std::chars_format::general, 6).ptr;
+            out.append(buf, end);
+        });
+        s.next = to + 1;
+    }
+    ov.erase(ov.begin(), oi);
+    if (s.done()) out += "\r\n";
+    return chunk;
+}
+
+// Segment wysłany w całości: niedokończony STATE dostaje kolejny kawałek
+// (zwraca true), każdy inny można zdjąć z kolejki.
+static bool refill_segment(outbound_segment &seg) {
+    if (!seg.stream) return false;
+    seg.data = next_state_chunk(*seg.stream);
+    seg.offset = 0;
+    if (seg.stream->done()) seg.stream.reset();
+    return true;
+}
+
+static bool enable_zerocopy(int fd) {
+#ifdef SO_ZEROCOPY
+    int on = 1;
+    return zerocopy_threshold > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+// Klient lokalny: kolejka trafia do pierścienia. Czego się nie zmieści,
+// czeka w kolejce, aż klient zwolni miejsce (pętla zagląda co 1 ms).
+// Przy uszkodzonym pierścieniu zwraca false, a klienta usuwa
+// handle_clients().
+static bool flush_local(client_info &info) {
+    size_t written = 0;
+    while (!info.outbound.empty()) {
+        outbound_segment &seg = info.outbound.front();
+        size_t avail = seg.data->size() - seg.offset;
+        size_t n = 0;
+        if (!shm_ring_write(info.shm->to_client,
+                            seg.data->data() + seg.offset, avail, n)) {
+            info.shm_broken = true;
+            info.outbound.clear();
+            return false;
+        }
+        written += n;
+        if (n < avail) {
+            seg.offset += n;
+            break;
+        }
+        if (!refill_segment(seg)) info.outbound.pop_front();
+    }
+    if (written > 0) shm_ring_notify(info.shm->to_client, info.shm_wake_fd);
+    return true;
+}
+
+// Zwraca false przy trwałym błędzie gniazda; EAGAIN zostawia resztę
+// w kolejce.
+static bool flush_outbound(client_info &info) {
+    if (info.shm != nullptr) return flush_local(info);
+    constexpr int MAX_IOV = 64;
+    int refills = 0;
+    while (!info.outbound.empty()) {
+        iovec iov[MAX_IOV];
+        int n = 0;
+        size_t total = 0;
+        for (auto it = info.outbound.begin();
+             it != info.outbound.end() && n < MAX_IOV; ++it) {
+            iov[n].iov_base = const_cast<char*>(it->data->data()) + it->offset;
+            iov[n].iov_len = it->data->size() - it->offset;
+            total += iov[n].iov_len;
+            ++n;
+            // Za niedokończonym STATE nic jeszcze nie może pójść.
+            if (it->stream) break;
+        }
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        int flags = MSG_NOSIGNAL;
+        // SO_ZEROCOPY włączamy przy pierwszym dużym wysłaniu, a nie przy
+        // accept(): większość klientów nigdy tyle nie dostanie.
+        if (!info.zerocopy_probed && total >= zerocopy_threshold) {
+            info.zerocopy_probed = true;
+            info.zerocopy = enable_zerocopy(info.socket_fd);
+        }
+        bool zc = info.zerocopy && total >= zerocopy_threshold;
+#ifdef MSG_ZEROCOPY
+        if (zc) flags |= MSG_ZEROCOPY;
+#endif
+        ssize_t sent = sendmsg(info.socket_fd, &msg, flags);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (zc && errno == ENOBUFS) {
+                // Przekroczony limit optmem: dalej zwykłym kopiowaniem.
+                info.zerocopy = false;
+                continue;
+            }
+            return false;
+        }
+        if (zc) {
+            zerocopy_pending pending{info.zc_seq++, {}};
+            for (int i = 0; i < n; ++i)
+                pending.buffers.push_back(info.outbound[i].data);
+            info.zc_inflight.push_back(std::move(pending));
+        }
+        size_t left = sent;
+        while (left > 0) {
+            outbound_segment &seg = info.outbound.front();
+            size_t avail = seg.data->size() - seg.offset;
+            if (left < avail) {
+                seg.offset += left;
+                break;
+            }
+            left -= avail;
+            if (refill_segment(seg)) ++refills;
+            else info.outbound.pop_front();
+        }
+        if (static_cast<size_t>(sent) < total ||
+            refills >= STATE_CHUNKS_PER_FLUSH) return true;
+    }
+    return true;
+}
+
+// Odbiera z kolejki błędów gniazda potwierdzenia wysyłek zero-copy
+// i zwalnia bufory, których jądro już nie używa.
+static void reap_zerocopy_completions(client_info &info) {
+    while (true) {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(info.socket_fd, &msg, MSG_ERRQUEUE) < 0) return;
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 &&
+                   cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            uint32_t lo = serr.ee_info, hi = serr.ee_data;
+            // Jądro i tak skopiowało dane (np. loopback): zero-copy na tym
+            // gnieździe tylko dokłada pracy, więc je wyłączamy.
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                info.zerocopy = false;
+            auto &q = info.zc_inflight;
+            q.erase(std::remove_if(q.begin(), q.end(),
+                [lo, hi](const zerocopy_pending &p) {
+                    return p.seq - lo <= hi - lo;
+                }), q.end());
+        }
+    }
+}
+
+// Dokłada bufory do kolejki klienta i próbuje je od razu wysłać.
+// Przy odtwarzaniu gniazda nie istnieją, więc nic nie wysyłamy.
+static bool send_buffers(client_info &info,
+    std::initializer_list<shared_buffer> bufs) {
+    if (replaying) return true;
+    for (const shared_buffer &b : bufs) {
+        if (!b->empty()) info.outbound.push_back({b, 0});
+    }
+    return flush_outbound(info);
+}
+
+// Kolejkuje STATE z bieżącego approx gracza `key`; przy małym K cały
+// mieści się w pierwszym kawałku.
+static bool send_state(client_info &info, int key) {
+    if (replaying) return true;
+    outbound_segment seg{nullptr, 0, std::make_unique<state_stream>()};
+    seg.stream->key = key;
+    seg.stream->last = engine.player(key).approx.k();
+    refill_segment(seg);
+    info.outbound.push_back(std::move(seg));
+    return flush_outbound(info);
+}
+
+// PUT zaraz zmieni approx[point]: STATE-y tego klienta, które do tego
+// punktu jeszcze nie doszły, zapamiętują wartość z chwili wysłania.
+static void preserve_pending_states(client_info &info, int key, int point) {
+    if (point < 0 || point > K) return;
+    for (outbound_segment &seg : info.outbound) {
+        if (!seg.stream || seg.stream->next > point) continue;
+        auto &ov = seg.stream->overrides;
+        auto it = std::lower_bound(ov.begin(), ov.end(), point,
+            [](const std::pair<int, double> &e, int p) { return e.first < p; });
+        if (it != ov.end() && it->first == point) continue;
+        ov.insert(it, {point, engine.player(key).approx.at(point)});
+    }
+}
+
+static ssize_t send_to_client(int fd, const std::string &msg) {
+    if (replaying) return static_cast<ssize_t>(msg.size());
+    auto it = clients.find(fd);
+    if (it == clients.end())
+        return send(fd, msg.c_str(), msg.size(), MSG_NOSIGNAL);
+    if (!send_buffers(it->second, {std::make_shared<const std::string>(msg)}))
+        return -1;
+    return static_cast<ssize_t>(msg.size());
+}
+
+// Bufory niepotwierdzonych wysyłek zero-copy jądro może jeszcze czytać:
+// po zwykłym close() kolejka wysyłki dalej wychodzi, a malloc mógł już
+// oddać tę pamięć na coś innego. Zerowe SO_LINGER zamienia close() w RST
+// i odrzuca kolejkę, więc potem bufory można zwolnić.
+static void abort_zerocopy_sends(client_info &info) {
+    reap_zerocopy_completions(info);
+    if (info.zc_inflight.empty()) return;
+    linger lg{1, 0};
+    setsockopt(info.socket_fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+}
+
+static void close_client_socket(int fd) {
+    if (replaying) return;
+    auto it = clients.find(fd);
+    if (it != clients.end() && !it->second.zc_inflight.empty())
+        abort_zerocopy_sends(it->second);
+    if (it != clients.end() && it->second.shm != nullptr) {
+        client_info &info = it->second;
+        munmap(info.shm, sizeof(shm_channel));
+        info.shm = nullptr;
+        info.outbound.clear();
+        local_ctrl_owner.erase(info.shm_ctrl_fd);
+        close(info.shm_ctrl_fd);
+        close(info.shm_memfd);
+        close(info.shm_wake_fd);
+    }
+    close(fd);
+    if (it != clients.end()) it->second.zc_inflight.clear();
+}
+
+// Linie COEFF przydzielone w nagraniu, w kolejności przydziału.
+static std::queue<std::string> replay_coeff_lines;
+
+// Linie COEFF odłożone przy przekazaniu samych gniazd nasłuchujących dla
+// klientów, którzy jeszcze nie przysłali HELLO; resztę pliku ma następca.
+static std::queue<std::string> reserved_coeff_lines;
+
 static std::ifstream coeff_file;
 
-static bool send_coeff_line(int key) {
+static bool handover_draining = false;
+
+// Kolejna linia COEFF: z pliku, a przy odtwarzaniu z dziennika.
+static bool next_coeff_line(std::string &line) {
+    if (replaying) {
+        if (replay_coeff_lines.empty()) {
+            print_error("Brak kolejnej linii COEFF w dzienniku");
+            return false;
+        }
+        line = replay_coeff_lines.front();
+        replay_coeff_lines.pop();
+        return true;
+    }
+    if (handover_draining) {
+        if (reserved_coeff_lines.empty()) {
+            print_error("Brak odłożonej linii COEFF");
+            return false;
+        }
+        line = reserved_coeff_lines.front();
+        reserved_coeff_lines.pop();
+        return true;
+    }
     if (!coeff_file.is_open()) {
         print_error("Plik z COEFF nie jest otwarty");
         return false;
     }
-    std::string line;
     if (!std::getline(coeff_file, line)) {
         print_error("Brak kolejnej linii w pliku COEFF");
         return false;
     }
+    return true;
+}
+
+// Pozycja następnej linii COEFF do zapisania w migawce lub przekazaniu.
+// Po dojściu do końca pliku tellg() zwraca -1, więc najpierw czyścimy
+// stan strumienia; kolejny odczyt i tak znów trafi na koniec pliku.
+static int64_t coeff_file_offset() {
+    if (!coeff_file.is_open()) return 0;
+    coeff_file.clear();
+    return static_cast<int64_t>(coeff_file.tellg());
+}
+
+// ---------------------------------------------------------------------
+// Migawki stanu gry (-c) i szybkie wznowienie (--resume)
+// ---------------------------------------------------------------------
+
+// Plik migawki to nagłówek i tablica slotów stałego rozmiaru, po jednym
+// na gracza, zmapowana w pamięci. Co checkpoint_interval_ms zapisujemy
+// tylko sloty klientów zmienionych od poprzedniej migawki; kopiowaniem
+// do mapy i msync zajmuje się osobny wątek.
+
+static constexpr char CHECKPOINT_MAGIC[4] = {'A', 'P', 'X', 'C'};
+static constexpr uint32_t CHECKPOINT_VERSION = 1;
+static constexpr size_t CHECKPOINT_NAME_MAX = 64;
+static constexpr int CHECKPOINT_MAX_COEFFS = 9; // N <= 8
+
+struct checkpoint_file_header {
+    char magic[4];
+    uint32_t version;
+    int32_t k, n, m, curr_m;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    int64_t coeff_offset;   // pozycja w pliku COEFF
+    uint64_t generation;
+};
+static_assert(sizeof(checkpoint_file_header) == 48, "checkpoint header");
+
+// Po nagłówku slotu leży K + 1 wartości approx.
+struct checkpoint_slot_header {
+    uint8_t used;
+    uint8_t name_len;
+    uint16_t reserved;
+    int32_t puts_count;
+    int32_t sent_put;
+    int32_t reserved2;
+    double penalty;
+    char name[CHECKPOINT_NAME_MAX];
+    double coeffs[CHECKPOINT_MAX_COEFFS];
+};
+
+static size_t checkpoint_slot_size() {
+    return sizeof(checkpoint_slot_header) + sizeof(double) * (K + 1);
+}
+
+// Stan gracza odczytany z migawki, czekający aż gracz wróci.
+struct saved_player {
+    int slot{-1};
+    std::string name{};
+    std::vector<double> coeffs{};
+    approx_store approx{};
+    double penalty{0.0};
+    int puts_count{0};
+    int sent_put{0};
+};
+
+// Kluczem jest slot, a nie nazwa: gracze o tej samej nazwie mają
+// osobne sloty i każdy wraca do swojego.
+static std::map<int, saved_player> saved_players;
+
+struct checkpoint_writer {
+    int fd{-1};
+    char *map{nullptr};
+    size_t map_size{0};
+    uint32_t slot_count{0};
+    uint64_t generation{0};
+    std::vector<bool> slot_used{};  // własność pętli zdarzeń
+    std::chrono::steady_clock::time_point last{};
+    // Zlecenia dla wątku zapisującego, chronione przez mutex.
+    std::vector<std::pair<int, std::vector<char>>> queued{};
+    checkpoint_file_header queued_header{};
+    bool header_pending{false};
+    bool stop{false};
+    std::mutex mutex{};
+    std::condition_variable cv{};
+    std::thread thread{};
+};
+
+static checkpoint_writer checkpoint;
+
+static bool checkpoint_enabled() {
+    return checkpoint.fd != -1;
+}
+
+// Powiększa plik i mapę; wołane przez wątek zapisujący albo przed jego
+// startem.
+static bool checkpoint_ensure_slots(uint32_t count) {
+    if (count <= checkpoint.slot_count && checkpoint.map != nullptr)
+        return true;
+    uint32_t cap = std::max<uint32_t>(checkpoint.slot_count, 64);
+    while (cap < count) cap *= 2;
+    size_t size = sizeof(checkpoint_file_header) +
+        static_cast<size_t>(cap) * checkpoint_slot_size();
+    if (ftruncate(checkpoint.fd, size) != 0) {
+        print_error("Nie udało się powiększyć migawki " + checkpoint_path);
+        return false;
+    }
+    if (checkpoint.map != nullptr) munmap(checkpoint.map, checkpoint.map_size);
+    void *m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   checkpoint.fd, 0);
+    if (m == MAP_FAILED) {
+        checkpoint.map = nullptr;
+        print_error("mmap() migawki nie powiódł się");
+        return false;
+    }
+    checkpoint.map = static_cast<char*>(m);
+    checkpoint.map_size = size;
+    checkpoint.slot_count = cap;
+    return true;
+}
+
+static char *checkpoint_slot_ptr(int slot) {
+    return checkpoint.map + sizeof(checkpoint_file_header) +
+        static_cast<size_t>(slot) * checkpoint_slot_size();
+}
+
+static void checkpoint_thread_main() {
+    std::vector<std::pair<int, std::vector<char>>> batch;
+    checkpoint_file_header hdr{};
+    std::unique_lock<std::mutex> lock(checkpoint.mutex);
+    while (true) {
+        checkpoint.cv.wait(lock, [] {
+            return checkpoint.stop || checkpoint.header_pending;
+        });
+        bool stopping = checkpoint.stop;
+        bool have_header = checkpoint.header_pending;
+        batch.swap(checkpoint.queued);
+        hdr = checkpoint.queued_header;
+        checkpoint.header_pending = false;
+        lock.unlock();
+
+        if (have_header) {
+            int max_slot = -1;
+            for (const auto &item : batch)
+                max_slot = std::max(max_slot, item.first);
+            if (checkpoint_ensure_slots(max_slot + 1)) {
+                for (const auto &item : batch) {
+                    memcpy(checkpoint_slot_ptr(item.first),
+                           item.second.data(), item.second.size());
+                }
+                // Nagłówek na końcu: generation rośnie dopiero wtedy,
+                // gdy wszystkie sloty tej migawki są już na miejscu.
+                hdr.slot_count = checkpoint.slot_count;
+                memcpy(checkpoint.map, &hdr, sizeof(hdr));
+                msync(checkpoint.map, checkpoint.map_size, MS_SYNC);
+            }
+            batch.clear();
+        }
+        if (stopping) return;
+        lock.lock();
+    }
+}
+
+static void checkpoint_start_writer() {
+    checkpoint.last = server_now();
+    checkpoint.thread = std::thread(checkpoint_thread_main);
+}
+
+// Otwiera plik migawki. Przy --resume odczytuje z niego stan gry:
+// liczniki, pozycję w pliku COEFF i sloty graczy, kopiując approx
+// prosto z mapy.
+static bool checkpoint_open() {
+    checkpoint.fd = open(checkpoint_path.c_str(),
+        O_RDWR | O_CREAT | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    if (checkpoint.fd < 0) {
+        print_error("Nie udało się otworzyć migawki: " + checkpoint_path);
+        return false;
+    }
+    struct stat st{};
+    fstat(checkpoint.fd, &st);
+    if (!resume || st.st_size < (off_t)sizeof(checkpoint_file_header)) {
+        if (resume) std::cout << "No checkpoint to resume from.\n";
+        if (ftruncate(checkpoint.fd, 0) != 0) return false;
+        return checkpoint_ensure_slots(1);
+    }
+
+    checkpoint_file_header hdr{};
+    if (pread(checkpoint.fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != CHECKPOINT_VERSION) {
+        print_error("Niepoprawny plik migawki: " + checkpoint_path);
+        return false;
+    }
+    // Nagłówek pochodzi z pliku: N wyznacza, ile współczynników czytamy
+    // z tablicy coeffs w slocie, a K rozmiar slotu i approx.
+    if (hdr.n < 1 || hdr.n > CHECKPOINT_MAX_COEFFS - 1 ||
+        hdr.k < 1 || hdr.k > K_MAX || hdr.m < 1 ||
+        hdr.curr_m < 0 || hdr.curr_m > hdr.m) {
+        print_error("Uszkodzony nagłówek migawki: " + checkpoint_path);
+        return false;
+    }
+    if ((k_given && hdr.k != K) || (n_given && hdr.n != N) ||
+        (m_given && hdr.m != M)) {
+        print_error("Migawka " + checkpoint_path + " ma K=" +
+                    std::to_string(hdr.k) + " N=" + std::to_string(hdr.n) +
+                    " M=" + std::to_string(hdr.m) +
+                    ", niezgodne z -k/-n/-m");
+        return false;
+    }
+    K = hdr.k;
+    N = hdr.n;
+    M = hdr.m;
+    currM = hdr.curr_m;
+    engine.configure(K, N);
+    checkpoint.generation = hdr.generation;
+    if (hdr.slot_size != checkpoint_slot_size() ||
+        st.st_size < (off_t)(sizeof(hdr) +
+            static_cast<size_t>(hdr.slot_count) * hdr.slot_size)) {
+        print_error("Uszkodzony plik migawki: " + checkpoint_path);
+        return false;
+    }
+    checkpoint.slot_count = 0;
+    if (!checkpoint_ensure_slots(hdr.slot_count)) return false;
+    coeff_file.seekg(hdr.coeff_offset);
+
+    checkpoint.slot_used.assign(checkpoint.slot_count, false);
+    for (uint32_t i = 0; i < hdr.slot_count; ++i) {
+        const char *p = checkpoint_slot_ptr(i);
+        checkpoint_slot_header sh{};
+        memcpy(&sh, p, sizeof(sh));
+        if (!sh.used) continue;
+        if (sh.name_len > CHECKPOINT_NAME_MAX) {
+            print_error("Uszkodzony slot " + std::to_string(i) +
+                        " migawki, pomijamy");
+            continue;
+        }
+        const double *approx = reinterpret_cast<const double*>(p + sizeof(sh));
+        saved_player sp;
+        sp.slot = i;
+        sp.coeffs.assign(sh.coeffs, sh.coeffs + N + 1);
+        sp.approx.assign(approx, K);
+        sp.penalty = sh.penalty;
+        sp.puts_count = sh.puts_count;
+        sp.sent_put = sh.sent_put;
+        // Gracz jest na razie rozłączony, więc jak przy każdym
+        // rozłączeniu jego PUT-y wracają do puli.
+        currM += sh.sent_put;
+        checkpoint.slot_used[i] = true;
+        sp.name.assign(sh.name, sh.name_len);
+        saved_players[i] = std::move(sp);
+    }
+    std::cout << "Resumed game from " << checkpoint_path << " (K=" << K
+              << ", N=" << N << ", M=" << M << "): "
+              << saved_players.size() << " players, " << currM
+              << " PUTs left.\n";
+    return true;
+}
+
+static int checkpoint_alloc_slot() {
+    auto it = std::find(checkpoint.slot_used.begin(),
+                        checkpoint.slot_used.end(), false);
+    int slot = static_cast<int>(it - checkpoint.slot_used.begin());
+    if (it == checkpoint.slot_used.end())
+        checkpoint.slot_used.push_back(true);
+    else
+        *it = true;
+    return slot;
+}
+
+static void checkpoint_mark_dirty(client_info &info) {
+    if (checkpoint_enabled()) info.checkpoint_dirty = true;
+}
+
+static std::vector<char> checkpoint_image(const approx_player &p) {
+    std::vector<char> image(checkpoint_slot_size());
+    checkpoint_slot_header sh{};
+    sh.used = 1;
+    sh.name_len = static_cast<uint8_t>(p.username.size());
+    sh.puts_count = p.puts_count;
+    sh.sent_put = p.sent_put;
+    sh.penalty = p.penalty;
+    memcpy(sh.name, p.username.data(), p.username.size());
+    for (size_t i = 0; i < p.coeffs.size() &&
+         i < (size_t)CHECKPOINT_MAX_COEFFS; ++i)
+        sh.coeffs[i] = p.coeffs[i];
+    memcpy(image.data(), &sh, sizeof(sh));
+    double *approx = reinterpret_cast<double*>(image.data() + sizeof(sh));
+    p.approx.for_each([approx](int x, double v) { approx[x] = v; });
+    return image;
+}
+
+// Slot zwolniony: wystarczy nadpisać sam nagłówek slotu.
+static void checkpoint_release_slot(int slot) {
+    if (!checkpoint_enabled() || slot < 0) return;
+    checkpoint.slot_used[slot] = false;
+    std::vector<char> image(sizeof(checkpoint_slot_header), 0);
+    std::lock_guard<std::mutex> lock(checkpoint.mutex);
+    checkpoint.queued.emplace_back(slot, std::move(image));
+}
+
+// Wywoływane z pętli zdarzeń; zleca zapis zmienionych slotów i nagłówka.
+static void checkpoint_tick(bool force = false) {
+    if (!checkpoint_enabled()) return;
+    auto now = server_now();
+    if (!force && now - checkpoint.last <
+        std::chrono::milliseconds(checkpoint_interval_ms))
+        return;
+    checkpoint.last = now;
+
+    std::vector<std::pair<int, std::vector<char>>> batch;
+    for (auto &[fd, info] : clients) {
+        if (!info.checkpoint_dirty) continue;
+        info.checkpoint_dirty = false;
+        const approx_player &player = engine.player(fd);
+        if (player.username.size() > CHECKPOINT_NAME_MAX) continue;
+        if (info.checkpoint_slot == -1)
+            info.checkpoint_slot = checkpoint_alloc_slot();
+        batch.emplace_back(info.checkpoint_slot, checkpoint_image(player));
+    }
+
+    checkpoint_file_header hdr{};
+    memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic));
+    hdr.version = CHECKPOINT_VERSION;
+    hdr.k = K;
+    hdr.n = N;
+    hdr.m = M;
+    // Gracze w migawce przy wznowieniu liczą się jako rozłączeni,
+    // więc currM zapisujemy bez ich PUT-ów (zob. checkpoint_open).
+    int pending_puts = 0;
+    for (const auto &[slot, sp] : saved_players) pending_puts += sp.sent_put;
+    hdr.curr_m = currM - pending_puts;
+    hdr.slot_size = checkpoint_slot_size();
+    hdr.coeff_offset = coeff_file_offset();
+    hdr.generation = ++checkpoint.generation;
+    {
+        std::lock_guard<std::mutex> lock(checkpoint.mutex);
+        for (auto &item : batch) checkpoint.queued.push_back(std::move(item));
+        checkpoint.queued_header = hdr;
+        checkpoint.header_pending = true;
+    }
+    checkpoint.cv.notify_one();
+}
+
+static int checkpoint_poll_timeout() {
+    if (!checkpoint_enabled()) return -1;
+    for (const auto &[fd, info] : clients) {
+        if (info.checkpoint_dirty) return checkpoint_interval_ms;
+    }
+    return -1;
+}
+
+static void checkpoint_close() {
+    if (!checkpoint_enabled()) return;
+    checkpoint_tick(true);
+    {
+        std::lock_guard<std::mutex> lock(checkpoint.mutex);
+        checkpoint.stop = true;
+    }
+    checkpoint.cv.notify_one();
+    checkpoint.thread.join();
+    munmap(checkpoint.map, checkpoint.map_size);
+    close(checkpoint.fd);
+    checkpoint.fd = -1;
+    checkpoint.map = nullptr;
+    checkpoint.map_size = 0;
+    checkpoint.slot_count = 0;
+    checkpoint.stop = false;
+}
+
+// Ponowne otwarcie migawki w trakcie gry, po przekazaniu gniazd: gracze
+// obecni w `clients` nie czekają na powrót, a currM się nie zmienia.
+static bool checkpoint_reattach() {
+    int keep_m = currM;
+    resume = true;
+    saved_players.clear();
+    if (!checkpoint_open()) return false;
+    for (const auto &[fd, info] : clients)
+        saved_players.erase(info.checkpoint_slot);
+    currM = keep_m;
+    checkpoint_start_writer();
+    return true;
+}
+
+// "adres:port" klienta do logów, w buforze wołającego (bez alokacji).
+static constexpr size_t PEER_TEXT_MAX = INET6_ADDRSTRLEN + 8;
+
+static const char *peer_text(const sockaddr_storage &addr,
+    char (&out)[PEER_TEXT_MAX]) {
+    char buf[INET6_ADDRSTRLEN];
+    uint16_t port = 0;
+    if (addr.ss_family == AF_INET) {
+        const sockaddr_in *a = reinterpret_cast<const sockaddr_in*>(&addr);
+        inet_ntop(AF_INET, &a->sin_addr, buf, sizeof(buf));
+        port = ntohs(a->sin_port);
+    } else {
+        const sockaddr_in6 *a6 = reinterpret_cast<const sockaddr_in6*>(&addr);
+        inet_ntop(AF_INET6, &a6->sin6_addr, buf, sizeof(buf));
+        port = ntohs(a6->sin6_port);
+    }
+    snprintf(out, sizeof(out), "%s:%u", buf, static_cast<unsigned>(port));
+    return out;
+}
+
+// Nazwa klienta w logach. Dla klientów TCP tekst powstaje dopiero przy
+// pierwszym użyciu, a nie przy accept().
+static const std::string &client_name(const client_info &info) {
+    if (info.addr_text.empty()) {
+        char buf[PEER_TEXT_MAX];
+        info.addr_text = peer_text(info.addr, buf);
+    }
+    return info.addr_text;
+}
+
+// To samo bez zapamiętywania, dla logów, które pisze każdy gracz.
+static const char *client_name(const client_info &info,
+    char (&buf)[PEER_TEXT_MAX]) {
+    return info.addr_text.empty() ? peer_text(info.addr, buf) :
+        info.addr_text.c_str();
+}
+
+// Gracz wrócił po wznowieniu serwera: odzyskuje swój slot i stan,
+// a COEFF wysyłamy ze współczynników zapisanych w migawce.
+static bool reclaim_saved_player(int key) {
+    client_info &info = clients[key];
+    approx_player &player = engine.player(key);
+    auto it = std::find_if(saved_players.begin(), saved_players.end(),
+        [&player](const auto &entry) {
+            return entry.second.name == player.username;
+        });
+    if (it == saved_players.end()) return false;
+    saved_player &sp = it->second;
+    player.coeffs = std::move(sp.coeffs);
+    player.approx = std::move(sp.approx);
+    player.penalty = sp.penalty;
+    player.puts_count = sp.puts_count;
+    player.sent_put = sp.sent_put;
+    info.checkpoint_slot = sp.slot;
+    currM -= sp.sent_put;
+    saved_players.erase(it);
+
+    std::string line = "COEFF";
+    char buf[32];
+    for (double c : player.coeffs) {
+        snprintf(buf, sizeof(buf), " %.17g", c);
+        line += buf;
+    }
+    journal_event(JournalEvent::Coeff, key, 0, 0.0, line);
+    if (send_to_client(info.socket_fd, line + "\r\n") < 0) {
+        print_error("Błąd wysyłania COEFF " + client_name(info));
+    }
+    APPROX_PROBE3(coeff, key, player.username.c_str(), line.c_str());
+    std::cout << player.username << " reclaimed its slot.\n";
+    return true;
+}
+
+static bool send_coeff_line(int key) {
+    std::string line;
+    if (!next_coeff_line(line)) return false;
     // Plik ma linie kończące się "\r\n", std::getline usunie '\n',
     // więc sprawdzamy, czy na końcu został '\r'
     if (!line.empty() && line.back() == '\r') {
@@ -77,13 +1147,17 @@ static bool send_coeff_line(int key) {
     }
     // Teraz 'line' powinno mieć format "COEFF a0 a1 ... aN"
     // 1) wyślij klientowi tę linię + "\r\n"
+    journal_event(JournalEvent::Coeff, key, 0, 0.0, line);
     std::string msg = line + "\r\n";
-    int sent = send(clients[key].socket_fd, msg.c_str(), msg.size(), 0);
+    int sent = send_to_client(clients[key].socket_fd, msg);
     if (sent < 0) {
-        print_error("Błąd wysyłania COEFF " + clients[key].addr_text);
+        print_error("Błąd wysyłania COEFF " + client_name(clients[key]));
         return false;
     }
-    // Sparsowanie liczby do wektora clients[key].coeffs pomijając "COEFF"
+    APPROX_PROBE3(coeff, key, engine.player(key).username.c_str(),
+                  line.c_str());
+    // Sparsowanie liczby do wektora coeffs gracza pomijając "COEFF"
+    std::vector<double> &coeffs = engine.player(key).coeffs;
     std::istringstream iss(line);
     std::string token;
     iss >> token; // pobierz "COEFF"
@@ -94,66 +1168,56 @@ static bool send_coeff_line(int key) {
             print_error("Błąd parsowania współczynnika " + std::to_string(i));
             return false;
         }
-        clients[key].coeffs.push_back(a);
+        coeffs.push_back(a);
     }
     return true;
 }
 
-// Funkcja do tworzenia kluczy do mapy klientów.
-static std::string peer_key(const sockaddr_storage &addr) {
-    char buf[INET6_ADDRSTRLEN];
-    uint16_t port = 0;
-    if (addr.ss_family == AF_INET) {
-        const sockaddr_in *a = reinterpret_cast<const sockaddr_in*>(&addr);
-        inet_ntop(AF_INET, &a->sin_addr, buf, sizeof(buf));
-        port = ntohs(a->sin_port);
-    } else {
-        const sockaddr_in6 *a6 = reinterpret_cast<const sockaddr_in6*>(&addr);
-        inet_ntop(AF_INET6, &a6->sin6_addr, buf, sizeof(buf));
-        port = ntohs(a6->sin6_port);
-    }
-    return std::string(buf) + ":" + std::to_string(port);
-}
-
 static bool handle_hello(int key, std::string &msg) {
     if (clients.find(key) == clients.end()) {
         print_error("Unknown client");
         return false;
     }
-    if (clients[key].state != State::AwaitingHello) {
+    if (clients[key].spectator ||
+        engine.player(key).state != State::AwaitingHello) {
         print_error("Client already sent HELLO");
         return false;
     }
-    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point t = server_now();
     if (t - clients[key].connect_time > std::chrono::seconds(TIMEOUT)) {
+        close_client_socket(clients[key].socket_fd);
         clients.erase(key);
+        engine.leave(key);
         return true;
     }
-    for (unsigned int i = 6; i < msg.size(); i++) {
-        char c = msg[i];
-        if (!(std::isdigit(c) ||
-            (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
-            print_error("Invalid player_id");
-            return false;
-        }
-        clients[key].username += c;
-        if (c >= 'a' && c <= 'z')
-            clients[key].lowercase++;
+    if (!engine.join(key, msg.substr(6))) {
+        print_error("Invalid player_id");
+        return false;
+    }
+    const approx_player &player = engine.player(key);
+    APPROX_PROBE2(hello, key, player.username.c_str());
+    char name[PEER_TEXT_MAX];
+    std::cout << client_name(clients[key], name) <<
+        " is now known as " << player.username << ".\n";
+    checkpoint_mark_dirty(clients[key]);
+    if (checkpoint_enabled() &&
+        player.username.size() > CHECKPOINT_NAME_MAX) {
+        std::cout << player.username << " is not checkpointed: name longer "
+                  << "than " << CHECKPOINT_NAME_MAX << " bytes.\n";
     }
-    clients[key].state = State::AwaitingPut;
-    std::cout << clients[key].addr_text <<
-        " is now known as " << clients[key].username << ".\n";
-    // Po udanym HELLO od razu wysyłamy COEFF z pliku:
-    if (!send_coeff_line(key)) {
+    // Po udanym HELLO od razu wysyłamy COEFF z pliku (albo, po
+    // wznowieniu z migawki, współczynniki, które gracz już dostał):
+    if (!reclaim_saved_player(key) && !send_coeff_line(key)) {
         // jeśli coś nie poszło, usuwamy klienta
         print_error("Invalid COEFF message\n");
-        close(clients[key].socket_fd);
+        close_client_socket(clients[key].socket_fd);
         clients.erase(key);
+        engine.leave(key);
         return false;
     }
-    std::cout << clients[key].username << " get coefficients";
+    std::cout << player.username << " get coefficients";
     for (int i = 0; i <= N; ++i) {
-        std::cout << " " << clients[key].coeffs[i];
+        std::cout << " " << player.coeffs[i];
     }
     std::cout << ".\n";
     return true;
@@ -228,87 +1292,428 @@ static bool parse_value(const std::string &msg, size_t &i, double &value) {
     return true;
 }
 
-// Pomocnicza funkcja sprawdzająca zakres point i value
-static bool validate_put_range(int key, int point, double value) {
-    if (point < 0 || point > K || value < -5.0 || value > 5.0) {
-        clients[key].penalty += 10;
-        std::ostringstream oss;
-        oss << "BAD_PUT " << point << " " << value << "\r\n";
-        std::string buf = oss.str();
-        int sent = send(clients[key].socket_fd, buf.c_str(), buf.size(), 0);
-        if (sent < 0) {
-            print_error("Błąd wysyłania BAD_PUT " + clients[key].addr_text);
-            return false;
+// ---------------------------------------------------------------------
+// Plik wyników gier (--results)
+// ---------------------------------------------------------------------
+
+// Na koniec gry pętla zdarzeń tylko odkłada wyniki do kolejki. Wątek
+// zapisujący składa z nich blok kolumnowy (approx-results.h), gdy uzbiera
+// się --results-batch gier, a niepełną partię najpóźniej po
+// RESULTS_FLUSH_INTERVAL, i dopisuje go jednym write().
+
+static constexpr auto RESULTS_FLUSH_INTERVAL = std::chrono::seconds(1);
+
+struct results_game {
+    int64_t start_ns;
+    int64_t end_ns;
+    int32_t k, n, m;
+    std::vector<player_result> rows;
+};
+
+struct results_writer {
+    int fd{-1};
+    std::vector<results_game> queued{}; // chroniony przez mutex
+    std::mutex mutex{};
+    std::condition_variable cv{};
+    bool stop{false};
+    std::thread thread{};
+};
+
+static results_writer results_file;
+static int64_t game_start_ns = 0;        // początek bieżącej gry
+static int64_t replay_wall_start_ns = 0; // początek odtwarzanego nagrania
+
+// Czas systemowy w ns od epoki. Przy odtwarzaniu liczony od początku
+// nagrania, więc gry dostają swoje pierwotne czasy.
+static int64_t wall_now_ns() {
+    if (replaying) {
+        return replay_wall_start_ns + std::chrono::duration_cast<
+            std::chrono::nanoseconds>(replay_clock.time_since_epoch()).count();
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool results_enabled() {
+    return results_file.fd != -1;
+}
+
+static std::string results_encode_block(
+    const std::vector<results_game> &games) {
+    // Słownik nazw bloku: każdy gracz raz, wiersze trzymają indeks.
+    std::unordered_map<std::string, uint32_t> dict;
+    std::vector<const std::string*> names;
+    uint32_t rows = 0;
+    uint64_t name_bytes = 0;
+    for (const results_game &g : games) {
+        for (const player_result &r : g.rows) {
+            ++rows;
+            auto [it, fresh] = dict.try_emplace(r.username,
+                static_cast<uint32_t>(names.size()));
+            if (!fresh) continue;
+            names.push_back(&it->first);
+            name_bytes += r.username.size();
         }
     }
-    return true;
+    results_block_layout l = results_layout(games.size(), rows,
+                                            names.size(), name_bytes);
+    std::string block(l.size, '\0');
+    char *base = block.data();
+    auto put = [base](size_t column, size_t i, auto v) {
+        memcpy(base + column + i * sizeof(v), &v, sizeof(v));
+    };
+
+    results_block_header hdr{};
+    memcpy(hdr.magic, RESULTS_BLOCK_MAGIC, sizeof(hdr.magic));
+    hdr.games = games.size();
+    hdr.rows = rows;
+    hdr.names = names.size();
+    hdr.name_bytes = name_bytes;
+    hdr.size = l.size;
+    memcpy(base, &hdr, sizeof(hdr));
+
+    size_t row = 0;
+    for (size_t g = 0; g < games.size(); ++g) {
+        const results_game &game = games[g];
+        put(l.game_start, g, game.start_ns);
+        put(l.game_end, g, game.end_ns);
+        put(l.game_k, g, game.k);
+        put(l.game_n, g, game.n);
+        put(l.game_m, g, game.m);
+        put(l.game_players, g, static_cast<uint32_t>(game.rows.size()));
+        for (const player_result &r : game.rows) {
+            put(l.row_game, row, static_cast<uint32_t>(g));
+            put(l.row_name, row, dict[r.username]);
+            put(l.row_score, row, r.score);
+            put(l.row_penalty, row, r.penalty);
+            put(l.row_puts, row, static_cast<int32_t>(r.puts));
+            ++row;
+        }
+    }
+    uint32_t offset = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+        put(l.name_offsets, i, offset);
+        memcpy(base + l.name_data + offset, names[i]->data(),
+               names[i]->size());
+        offset += names[i]->size();
+    }
+    put(l.name_offsets, names.size(), offset);
+    return block;
 }
 
-// Pomocnicza funkcja sprawdzająca stan klienta
-static bool validate_put_state(int key, int point, double value) {
-    if (clients[key].state != State::AwaitingPut) {
-        clients[key].penalty += 20;
-        std::ostringstream oss;
-        oss << "PENALTY " << point << " " << value << "\r\n";
-        std::string buf = oss.str();
-        int sent = send(clients[key].socket_fd, buf.c_str(), buf.size(), 0);
-        if (sent < 0) {
-            print_error("Błąd wysyłania PENALTY " + clients[key].addr_text);
+static void results_write_all(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t w = write(results_file.fd, data, size);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            print_error("Błąd zapisu pliku wyników " + results_path);
+            return;
+        }
+        data += w;
+        size -= w;
+    }
+}
+
+static void results_thread_main() {
+    std::vector<results_game> batch;
+    std::unique_lock<std::mutex> lock(results_file.mutex);
+    while (true) {
+        results_file.cv.wait_for(lock, RESULTS_FLUSH_INTERVAL, [] {
+            return results_file.stop || results_file.queued.size() >=
+                static_cast<size_t>(results_batch);
+        });
+        batch.swap(results_file.queued);
+        bool stopping = results_file.stop;
+        lock.unlock();
+        if (!batch.empty()) {
+            std::string block = results_encode_block(batch);
+            results_write_all(block.data(), block.size());
+            batch.clear();
+        }
+        if (stopping) return;
+        lock.lock();
+    }
+}
+
+// Otwiera plik wyników do dopisywania. Nowy dostaje nagłówek, a w starym
+// odcinamy urwany ostatni blok. Z append == true (powrót po przekazaniu
+// gniazd, gdy następca mógł już zacząć pisać) pliku nie sprawdzamy.
+static bool results_open(bool append = false) {
+    results_file.fd = open(results_path.c_str(),
+        O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (results_file.fd < 0) {
+        print_error("Nie udało się otworzyć pliku wyników: " + results_path);
+        return false;
+    }
+    struct stat st{};
+    fstat(results_file.fd, &st);
+    if (!append && st.st_size == 0) {
+        results_file_header hdr{};
+        memcpy(hdr.magic, RESULTS_MAGIC, sizeof(hdr.magic));
+        hdr.version = RESULTS_VERSION;
+        results_write_all(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    } else if (!append) {
+        results_file_header hdr{};
+        if (pread(results_file.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            memcmp(hdr.magic, RESULTS_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != RESULTS_VERSION) {
+            print_error("Niepoprawny plik wyników: " + results_path);
+            close(results_file.fd);
+            results_file.fd = -1;
             return false;
         }
+        off_t end = sizeof(hdr);
+        results_block_header bh{};
+        while (pread(results_file.fd, &bh, sizeof(bh), end) == sizeof(bh) &&
+               memcmp(bh.magic, RESULTS_BLOCK_MAGIC, sizeof(bh.magic)) == 0 &&
+               bh.size == results_layout(bh.games, bh.rows, bh.names,
+                                         bh.name_bytes).size &&
+               bh.size <= static_cast<uint64_t>(st.st_size - end)) {
+            end += bh.size;
+        }
+        if (end < st.st_size) {
+            std::cout << "Dropping " << st.st_size - end
+                      << " bytes of a torn block from " << results_path
+                      << ".\n";
+            if (ftruncate(results_file.fd, end) != 0) {
+                print_error("Nie udało się przyciąć pliku wyników");
+                close(results_file.fd);
+                results_file.fd = -1;
+                return false;
+            }
+        }
     }
+    results_file.stop = false;
+    results_file.thread = std::thread(results_thread_main);
     return true;
 }
 
-static void update_approximation_and_respond(int key, int point, double val) {
-    // Dodaj wartość do funkcji aproksymującej
-    clients[key].approx[point] += val;
-    std::cout << clients[key].username
-          << " puts " << val
-          << " in " << point
-          << ", current state";
-    for (int x = 0; x <= K; ++x) {
-        std::cout << " " << clients[key].approx[x];
+// Odkłada wyniki skończonej gry. Gracze bez HELLO nie mają nazwy, więc
+// nie trafiają do rankingu.
+static void results_record_game(const std::vector<player_result> &results) {
+    if (!results_enabled()) return;
+    results_game game{game_start_ns, wall_now_ns(), K, N, M, {}};
+    game.rows.reserve(results.size());
+    for (const player_result &r : results) {
+        if (!r.username.empty()) game.rows.push_back(r);
     }
-    std::cout << ".\n";
-    auto t = std::chrono::steady_clock::now();
-    clients[key].send_time = t + std::chrono::seconds(clients[key].lowercase);
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(results_file.mutex);
+        results_file.queued.push_back(std::move(game));
+        full = results_file.queued.size() >=
+            static_cast<size_t>(results_batch);
+    }
+    if (full) results_file.cv.notify_one();
+}
 
-    // Zbuduj komunikat
-    std::ostringstream oss;
-    oss << "STATE";
-    for (int i = 0; i <= K; ++i) {
-        oss << " " << clients[key].approx[i];
+static void results_close() {
+    if (!results_enabled()) return;
+    {
+        std::lock_guard<std::mutex> lock(results_file.mutex);
+        results_file.stop = true;
+    }
+    results_file.cv.notify_one();
+    results_file.thread.join();
+    close(results_file.fd);
+    results_file.fd = -1;
+}
+
+// ---------------------------------------------------------------------
+// Widzowie (SPECTATE)
+// ---------------------------------------------------------------------
+
+// Połączenie, które zamiast HELLO przyśle "SPECTATE", nie gra, tylko
+// ogląda: dostaje linię "PUT <player_id> <point> <value>" dla każdego
+// przyjętego PUT-a i co spectator_interval_ms
+// "LEADERBOARD <pozostałe PUT-y> <player_id> <wynik> ..." (od najlepszego),
+// a na końcu gry zwykły SCORING. Zdarzenia z jednego obrotu pętli są
+// zbierane w jeden bufor i ten sam bufor trafia do kolejek wszystkich
+// widzów, więc koszt serializacji nie zależy od ich liczby.
+// Widz, który nie nadąża (więcej niż spectator_backlog buforów w kolejce),
+// traci zaległe zdarzenia i dostaje "SKIP"; kolejny LEADERBOARD przywraca
+// mu pełny obraz gry. Graczy to nigdy nie wstrzymuje.
+
+static std::set<int> spectators;
+static std::string spectator_events;   // zdarzenia z bieżącego obrotu
+static std::chrono::steady_clock::time_point spectator_last_board{};
+
+static const shared_buffer SPECTATOR_SKIP =
+    std::make_shared<const std::string>("SKIP\r\n");
+
+static bool handle_spectate(int key) {
+    auto it = clients.find(key);
+    if (it == clients.end() || !engine.contains(key) ||
+        engine.player(key).state != State::AwaitingHello) {
+        print_error("SPECTATE after HELLO or from unknown client");
+        return false;
     }
+    engine.leave(key);
+    it->second.spectator = true;
+    spectators.insert(key);
+    // Nowy widz dostaje pełny obraz przy najbliższym obrocie pętli.
+    spectator_last_board = {};
+    std::cout << client_name(it->second) << " is now spectating.\n";
+    return true;
+}
+
+static void record_put_event(const approx_player &player, int point,
+    double value) {
+    if (spectators.empty() || replaying) return;
+    // Wartość jak w STATE i SCORING: %g, 6 cyfr znaczących.
+    char buf[64];
+    buf[0] = ' ';
+    char *end = std::to_chars(buf + 1, buf + sizeof(buf), point).ptr;
+    *end++ = ' ';
+    end = std::to_chars(end, buf + sizeof(buf), value,
+                        std::chars_format::general, 6).ptr;
+    spectator_events += "PUT ";
+    spectator_events += player.username;
+    spectator_events.append(buf, end);
+    spectator_events += "\r\n";
+}
+
+// Widz z przepełnioną kolejką przeskakuje do bieżących zdarzeń. Rozpoczęty
+// bufor zostaje, żeby nie urwać linii w połowie.
+static void skip_spectator_ahead(client_info &info) {
+    size_t keep = !info.outbound.empty() && info.outbound.front().offset > 0;
+    info.outbound.resize(keep);
+    info.outbound.push_back({SPECTATOR_SKIP, 0});
+    if (info.spectator_skips++ == 0) {
+        std::cout << "Spectator " << client_name(info)
+                  << " is too slow, skipping ahead.\n";
+    }
+}
+
+static void broadcast_to_spectators(const shared_buffer &buf) {
+    for (int fd : spectators) {
+        client_info &info = clients[fd];
+        if (info.outbound.size() >= spectator_backlog)
+            skip_spectator_ahead(info);
+        info.outbound.push_back({buf, 0});
+        if (!flush_outbound(info)) info.outbound.clear();
+    }
+}
+
+static shared_buffer leaderboard_message() {
+    std::vector<std::pair<std::string, double>> results = engine.score();
+    results.erase(std::remove_if(results.begin(), results.end(),
+        [](const auto &r) { return r.first.empty(); }), results.end());
+    std::stable_sort(results.begin(), results.end(),
+        [](const auto &a, const auto &b) { return a.second < b.second; });
+    std::ostringstream oss;
+    oss << "LEADERBOARD " << currM;
+    for (const auto &pr : results) oss << " " << pr.first << " " << pr.second;
     oss << "\r\n";
-    clients[key].has_pending = true;
-    clients[key].pending_response = oss.str();
+    return std::make_shared<const std::string>(oss.str());
 }
 
-// Główna funkcja obsługi PUT
+// Raz na obrót pętli: wysyła zebrane zdarzenia i, gdy minął odstęp,
+// ranking.
+static void spectator_tick() {
+    if (spectators.empty() || replaying) return;
+    if (!spectator_events.empty()) {
+        broadcast_to_spectators(
+            std::make_shared<const std::string>(std::move(spectator_events)));
+        spectator_events.clear();
+    }
+    auto now = server_now();
+    if (now - spectator_last_board >=
+        std::chrono::milliseconds(spectator_interval_ms)) {
+        spectator_last_board = now;
+        broadcast_to_spectators(leaderboard_message());
+    }
+}
+
+static int spectator_poll_timeout() {
+    if (spectators.empty()) return -1;
+    auto due = spectator_last_board +
+        std::chrono::milliseconds(spectator_interval_ms);
+    auto now = server_now();
+    if (due <= now) return 0;
+    return static_cast<int>(std::chrono::duration_cast<
+        std::chrono::milliseconds>(due - now).count()) + 1;
+}
+
+// Odpowiedź na odrzucony PUT (BAD_PUT albo PENALTY) z jego argumentami.
+static bool send_put_rejection(int key, JournalEvent type, const char *tag,
+    int point, double value) {
+    journal_event(type, key, point, value);
+    std::ostringstream oss;
+    oss << tag << " " << point << " " << value << "\r\n";
+    if (send_to_client(clients[key].socket_fd, oss.str()) < 0) {
+        print_error(std::string("Błąd wysyłania ") + tag + " " +
+                    client_name(clients[key]));
+        return false;
+    }
+    return true;
+}
+
+// Stan gracza do logu: wartości po spacji albo, przy dużym K, tylko
+// ich liczba.
+static void log_state(const approx_store &approx) {
+    if (approx.k() > LOG_STATE_MAX_K) {
+        std::cout << " (" << approx.k() + 1 << " values)";
+        return;
+    }
+    approx.for_each([](int, double v) {
+        std::cout << " " << v;
+    });
+}
+
+// Główna funkcja obsługi PUT; zasady stosuje silnik, tu zostaje
+// parsowanie, odpowiedzi na błędy i log.
 static bool handle_put(int key, std::string &msg) {
     if (clients.find(key) == clients.end()) {
         print_error("Unknown client");
         return false;
     }
 
+    if (clients[key].spectator) {
+        print_error("PUT from spectator " + client_name(clients[key]));
+        return false;
+    }
+
     size_t i = 4;
     int point = 0;
     double value = 0.0;
 
     if (!parse_point(msg, i, point)) return false;
     if (!parse_value(msg, i, value)) return false;
-    if (!validate_put_range(key, point, value)) return false;
-    if (!validate_put_state(key, point, value)) return false;
-    if (clients[key].state != State::AwaitingPut ||
-        point < 0 || point > K || value < -5.0 || value > 5.0)
-        return true;
+    preserve_pending_states(clients[key], key, point);
+    put_outcome out = engine.put(key, point, value, server_now());
+    const approx_player &player = engine.player(key);
+    APPROX_PROBE5(put, key, player.username.c_str(), point,
+                  probe_micro(value), probe_ns(player.put_time));
+    checkpoint_mark_dirty(clients[key]);
+    if (out.bad_put) {
+        APPROX_PROBE4(bad_put, key, player.username.c_str(), point,
+                      probe_micro(value));
+        if (!send_put_rejection(key, JournalEvent::BadPut, "BAD_PUT",
+                                point, value))
+            return false;
+    }
+    if (out.penalty) {
+        APPROX_PROBE4(penalty, key, player.username.c_str(), point,
+                      probe_micro(value));
+        if (!send_put_rejection(key, JournalEvent::Penalty, "PENALTY",
+                                point, value))
+            return false;
+    }
+    if (!out.accepted()) return true;
 
+    APPROX_PROBE4(state_scheduled, key, player.username.c_str(),
+                  probe_ns(player.put_time), probe_ns(player.send_time));
     std::cout << "Received PUT: point="
     << point << " value=" << value << std::endl;
     currM--;
-    clients[key].sent_put++;
-    update_approximation_and_respond(key, value, point);
+    record_put_event(player, point, value);
+    std::cout << player.username
+          << " puts " << value
+          << " in " << point
+          << ", current state";
+    log_state(player.approx);
+    std::cout << ".\n";
 
     return true;
 }
@@ -329,7 +1734,7 @@ static bool parse_arguments(int argc, char *argv[]) {
             p = true;
         } else if (arg == "-k" && i + 1 < argc) {
             K = std::atoi(argv[++i]);
-            if (K < 1 || K > 10000 || k) {
+            if (K < 1 || K > K_MAX || k) {
                 print_error("Invalid value for -k (K)");
                 return false;
             }
@@ -356,15 +1761,126 @@ static bool parse_arguments(int argc, char *argv[]) {
             }
             filename = argv[++i];
             f = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            journal_path = argv[++i];
+        } else if (arg == "-J" && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy == "none") {
+                journal_fsync = FsyncPolicy::None;
+            } else if (policy == "batch") {
+                journal_fsync = FsyncPolicy::Batch;
+            } else if (policy == "interval") {
+                journal_fsync = FsyncPolicy::Interval;
+            } else {
+                print_error("Invalid value for -J (none|batch|interval)");
+                return false;
+            }
+        } else if (arg == "-r" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "-P") {
+            replay_paced = true;
+        } else if (arg == "-c" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else if (arg == "-C" && i + 1 < argc) {
+            checkpoint_interval_ms = std::atoi(argv[++i]);
+            if (checkpoint_interval_ms < 1) {
+                print_error("Invalid value for -C (checkpoint interval)");
+                return false;
+            }
+        } else if (arg == "--results" && i + 1 < argc) {
+            results_path = argv[++i];
+        } else if (arg == "--results-batch" && i + 1 < argc) {
+            results_batch = std::atoi(argv[++i]);
+            if (results_batch < 1) {
+                print_error("Invalid value for --results-batch");
+                return false;
+            }
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--inherit" && i + 1 < argc) {
+            inherit_fd = std::atoi(argv[++i]);
+        } else if (arg == "--handover-listen-only") {
+            handover_listen_only = true;
+        } else if (arg == "-U" && i + 1 < argc) {
+            server_binary = argv[++i];
+        } else if (arg == "--byte-rate" && i + 1 < argc) {
+            byte_rate = std::atof(argv[++i]);
+            if (byte_rate < 0) {
+                print_error("Invalid value for --byte-rate");
+                return false;
+            }
+        } else if (arg == "--msg-rate" && i + 1 < argc) {
+            msg_rate = std::atof(argv[++i]);
+            if (msg_rate < 0) {
+                print_error("Invalid value for --msg-rate");
+                return false;
+            }
+        } else if (arg == "-L" && i + 1 < argc) {
+            local_path = argv[++i];
+        } else if (arg == "--low-latency") {
+            low_latency = true;
+        } else if (arg == "--cpu" && i + 1 < argc) {
+            pin_cpu = std::atoi(argv[++i]);
+            if (pin_cpu < 0 || pin_cpu >= CPU_SETSIZE) {
+                print_error("Invalid value for --cpu");
+                return false;
+            }
+        } else if (arg == "--zerocopy" && i + 1 < argc) {
+            int v = std::atoi(argv[++i]);
+            if (v < 0) {
+                print_error("Invalid value for --zerocopy");
+                return false;
+            }
+            zerocopy_threshold = v;
+        } else if (arg == "--spectator-interval" && i + 1 < argc) {
+            spectator_interval_ms = std::atoi(argv[++i]);
+            if (spectator_interval_ms < 1) {
+                print_error("Invalid value for --spectator-interval");
+                return false;
+            }
+        } else if (arg == "--spectator-backlog" && i + 1 < argc) {
+            int v = std::atoi(argv[++i]);
+            if (v < 1) {
+                print_error("Invalid value for --spectator-backlog");
+                return false;
+            }
+            spectator_backlog = v;
+        } else if (arg == "--tick-msgs" && i + 1 < argc) {
+            tick_msg_budget = std::atoi(argv[++i]);
+            if (tick_msg_budget < 1) {
+                print_error("Invalid value for --tick-msgs");
+                return false;
+            }
+        } else if (arg == "--tick-bytes" && i + 1 < argc) {
+            int v = std::atoi(argv[++i]);
+            if (v < 16) {
+                print_error("Invalid value for --tick-bytes");
+                return false;
+            }
+            tick_byte_budget = v;
+        } else if (arg == "--max-line" && i + 1 < argc) {
+            int v = std::atoi(argv[++i]);
+            if (v < 16) {
+                print_error("Invalid value for --max-line");
+                return false;
+            }
+            max_line = v;
         } else {
             print_error("Unknown or incomplete argument: " + arg);
             return false;
         }
     }
-    if (!f) {
+    if (!f && replay_path.empty()) {
         print_error("Missing required -f argument (filename)");
         return false;
     }
+    if (resume && checkpoint_path.empty()) {
+        print_error("--resume requires -c (checkpoint file)");
+        return false;
+    }
+    k_given = k;
+    n_given = n;
+    m_given = m;
     return true;
 }
 
@@ -404,38 +1920,127 @@ int create_and_bind_socket(const char* port_str, int family) {
     return listen_fd;
 }
 
-void process_client_buffer(int fd) {
-    std::string& net_buffer = clients[fd].net_buffer;
-    if (net_buffer.size() > 7 && net_buffer.substr(0, 6) == "HELLO ") {
-        size_t pos = net_buffer.find("\r\n");
-        if (pos != std::string::npos) {
-            std::string msg = net_buffer.substr(0, pos);
+// Klient się rozłączył: jego PUT-y wracają do puli gry.
+static void forget_client(int fd) {
+    journal_event(JournalEvent::Disconnect, fd);
+    currM += engine.leave(fd);
+    spectators.erase(fd);
+    checkpoint_release_slot(clients[fd].checkpoint_slot);
+    clients.erase(fd);
+}
+
+// Klient przekroczył limity: zamykamy go od razu, z RST zamiast FIN,
+// żeby nie trzymać po nim zasobów jądra.
+static void shed_client(int fd, const std::string &reason) {
+    if (!replaying) {
+        linger lg{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close_client_socket(fd);
+    std::cout << "Dropping client " << client_name(clients[fd])
+              << ": " << reason << ".\n";
+    forget_client(fd);
+}
+
+static bool take_message_token(client_info &info) {
+    if (msg_rate <= 0 || replaying) return true;
+    info.msg_bucket.refill(msg_rate, server_now());
+    if (info.msg_bucket.tokens < 1.0) return false;
+    info.msg_bucket.tokens -= 1.0;
+    return true;
+}
+
+// Ile razy klient wyczerpał budżet obrotu pętli; raport na koniec gry.
+struct work_budget_stats {
+    uint64_t msg_hits{0};
+    uint64_t byte_hits{0};
+};
+
+static work_budget_stats budget_stats;
+
+static void report_work_budget() {
+    if (budget_stats.msg_hits == 0 && budget_stats.byte_hits == 0) return;
+    std::cout << "Work budget hits: " << budget_stats.msg_hits
+              << " message, " << budget_stats.byte_hits << " byte.\n";
+    budget_stats = work_budget_stats{};
+}
+
+// Przetwarza pełne linie z bufora klienta, najwyżej `budget` (i w granicach
+// --msg-rate; reszta czeka na kolejne żetony). Linie ponad budżet zostają
+// na następny obrót pętli z ustawionym `backlog`. Zwraca false, jeśli
+// klient został po drodze usunięty.
+bool process_client_buffer(int fd, int budget = INT_MAX) {
+    size_t start = 0;
+    int handled = 0;
+    auto self = clients.find(fd);
+    if (self != clients.end()) self->second.backlog = false;
+    while (true) {
+        auto it = clients.find(fd);
+        if (it == clients.end()) return false;
+        std::string &net_buffer = it->second.net_buffer;
+        size_t pos = net_buffer.find("\r\n", start);
+        size_t line_len = (pos == std::string::npos ?
+            net_buffer.size() : pos) - start;
+        if (line_len > max_line) {
+            shed_client(fd, "line too long");
+            return false;
+        }
+        if (pos == std::string::npos) break;
+        if (handled == budget) {
+            it->second.backlog = true;
+            budget_stats.msg_hits++;
+            break;
+        }
+        if (!take_message_token(it->second)) break;
+        handled++;
+        std::string msg = net_buffer.substr(start, line_len);
+        start = pos + 2;
+        if (msg.size() > 6 && msg.compare(0, 6, "HELLO ") == 0) {
+            journal_event(JournalEvent::Hello, fd, 0, 0.0, msg);
             if (!handle_hello(fd, msg)) {
                 print_error("Invalid HELLO message\n");
             }
-            net_buffer.erase(0, pos + 2);
-        }
-    }
-    if (net_buffer.size() > 7 && net_buffer.substr(0, 4) == "PUT ") {
-        size_t pos = net_buffer.find("\r\n");
-        if (pos != std::string::npos) {
-            std::string msg = net_buffer.substr(0, pos);
+        } else if (msg == "SPECTATE") {
+            journal_event(JournalEvent::Hello, fd, 0, 0.0, msg);
+            if (!handle_spectate(fd)) {
+                print_error("Invalid SPECTATE message\n");
+            }
+        } else if (msg.size() > 4 && msg.compare(0, 4, "PUT ") == 0) {
+            journal_event(JournalEvent::Put, fd, 0, 0.0, msg);
             if (!handle_put(fd, msg)) {
                 print_error("Invalid PUT message\n");
             }
-            net_buffer.erase(0, pos + 2);
+        } else {
+            print_error("Invalid message from " + client_name(it->second));
         }
     }
+    clients[fd].net_buffer.erase(0, start);
+    return true;
 }
 
 bool initialize(int argc, char* argv[]) {
     if (!parse_arguments(argc, argv)) return false;
+    engine.configure(K, N);
+    recv_buffer.resize(tick_byte_budget);
+    game_start_ns = wall_now_ns();
 
+    if (!replay_path.empty()) {
+        replaying = true;
+        return true;
+    }
     coeff_file.open(filename);
     if (!coeff_file) {
         print_error("Nie udało się otworzyć pliku: " + filename);
         return false;
     }
+    // Następca przejmuje migawkę i dziennik w receive_handover().
+    if (inherit_fd != -1) return true;
+    if (!checkpoint_path.empty()) {
+        if (!checkpoint_open()) return false;
+        checkpoint_start_writer();
+    }
+    if (!journal_path.empty() && !journal_open()) return false;
+    if (!results_path.empty() && !results_open()) return false;
 
     return true;
 }
@@ -464,19 +2069,45 @@ void display_assigned_port(int listen_fd6, int listen_fd4) {
     std::cout << "Listening on port: " << assigned_port << std::endl;
 }
 
+// Z TCP_DEFER_ACCEPT jądro oddaje połączenie do accept() dopiero, gdy
+// przyjdą pierwsze dane (HELLO albo SPECTATE), albo po DEFER_ACCEPT_SECS,
+// więc klient, który tylko otworzył połączenie, nie zajmuje od razu ani
+// fd, ani wpisu w `clients`. connect_time to chwila accept(), nie
+// uzgodnienia TCP: czas na HELLO może się wydłużyć najwyżej o to okno,
+// dlatego jest krótkie, a nie równe TIMEOUT.
+static constexpr int DEFER_ACCEPT_SECS = 1;
+
+static void defer_accept(int listen_fd) {
+    int secs = DEFER_ACCEPT_SECS;
+    setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs));
+}
+
 void prepare_sockets(int listen_fd6, int listen_fd4) {
     if (listen_fd6 != -1) {
         int off = 0;
         setsockopt(listen_fd6, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        defer_accept(listen_fd6);
         listen(listen_fd6, SOMAXCONN);
         set_nonblocking(listen_fd6);
     }
     if (listen_fd4 != -1) {
+        defer_accept(listen_fd4);
         listen(listen_fd4, SOMAXCONN);
         set_nonblocking(listen_fd4);
     }
 }
 
+// Klient bez żetonów albo z pełnym buforem nie jest czytany,
+// dopóki się nie uzupełnią (POLLHUP i tak dostaniemy). Żetony uzupełniamy
+// tutaj, a nie tylko przy odczycie: nieczytany klient inaczej nigdy by
+// ich nie dostał.
+static bool client_throttled(client_info &info,
+    std::chrono::steady_clock::time_point now) {
+    if (byte_rate > 0) info.byte_bucket.refill(byte_rate, now);
+    return (byte_rate > 0 && info.byte_bucket.tokens < 1.0) ||
+        info.net_buffer.size() >= 4 * max_line;
+}
+
 void prepare_pollfds(std::vector<pollfd>& pollfds,
     int listen_fd6, int listen_fd4) {
     pollfds.clear();
@@ -484,153 +2115,1162 @@ void prepare_pollfds(std::vector<pollfd>& pollfds,
         pollfds.push_back({listen_fd6, POLLIN, 0});
     if (listen_fd4 != -1)
         pollfds.push_back({listen_fd4, POLLIN, 0});
+    if (local_listen_fd != -1)
+        pollfds.push_back({local_listen_fd, POLLIN, 0});
+
+    auto now = server_now();
+    for (auto& [fd, info] : clients) {
+        short events = client_throttled(info, now) ? 0 : POLLIN;
+        if (info.shm != nullptr) {
+            // eventfd jest zawsze zapisywalny, więc bez POLLOUT.
+            pollfds.push_back({fd, events, 0});
+            pollfds.push_back({info.shm_ctrl_fd, POLLIN, 0});
+            continue;
+        }
+        if (!info.outbound.empty()) events |= POLLOUT;
+        pollfds.push_back({fd, events, 0});
+    }
+}
+
+// ---------------------------------------------------------------------
+// Tryb niskich opóźnień (--low-latency, --cpu)
+// ---------------------------------------------------------------------
+
+// Pętla zdarzeń nie zasypia w poll(), tylko odpytuje gniazda bez
+// czekania (z SO_BUSY_POLL tam, gdzie jądro je obsługuje); wątek pętli
+// jest przypięty do jednego rdzenia, a pamięć wstępnie dotknięta
+// i zablokowana. Koszt: jeden rdzeń zajęty w 100%.
+
+static constexpr int BUSY_POLL_USEC = 50;
+
+// Czas od odebrania PUT do wysłania STATE, bez zamierzonego opóźnienia
+// za małe litery w player_id.
+static latency_histogram state_latency;
+
+static void apply_low_latency_socket_options(int fd) {
+    if (!low_latency) return;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_BUSY_POLL
+    int usec = BUSY_POLL_USEC;
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#endif
+}
+
+// Przypina wątek pętli i przygotowuje pamięć. Wołane po starcie wątków
+// zapisujących, więc one nie dziedziczą przypięcia.
+static void enter_low_latency_mode() {
+    if (pin_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pin_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            print_error("Nie udało się przypiąć pętli do CPU " +
+                        std::to_string(pin_cpu));
+    }
+    if (!low_latency) return;
+    // Zwolniona pamięć zostaje w stercie, żeby późniejsze alokacje nie
+    // wracały do jądra po nowe (i niezablokowane) strony.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        print_error("mlockall() nie powiódł się, pamięć nie jest zablokowana");
+    constexpr size_t PREFAULT_HEAP = 64 << 20;
+    constexpr size_t PREFAULT_STACK = 256 << 10;
+    char *heap = static_cast<char*>(malloc(PREFAULT_HEAP));
+    if (heap != nullptr) {
+        for (size_t i = 0; i < PREFAULT_HEAP; i += 4096) heap[i] = 0;
+        free(heap);
+    }
+    volatile char stack[PREFAULT_STACK];
+    for (size_t i = 0; i < PREFAULT_STACK; i += 4096) stack[i] = 0;
+    (void)stack[0];
+    std::cout << "Low-latency mode" <<
+        (pin_cpu >= 0 ? " on CPU " + std::to_string(pin_cpu) : "") << ".\n";
+}
+
+static void report_latency() {
+    if (!low_latency || state_latency.total == 0) return;
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    std::cout << "Latency PUT->STATE (us): n=" << state_latency.total
+              << " p50=" << us(state_latency.percentile(50))
+              << " p90=" << us(state_latency.percentile(90))
+              << " p99=" << us(state_latency.percentile(99))
+              << " p99.9=" << us(state_latency.percentile(99.9))
+              << " max=" << us(state_latency.max) << ".\n";
+    state_latency = latency_histogram{};
+}
+
+// `name` podajemy dla klientów bez adresu TCP (lokalni, odtwarzani
+// z dziennika); pozostałym nazwa powstaje w client_name().
+static void register_client(int client_fd, const sockaddr_storage &addr,
+    const char *name = nullptr) {
+    char buf[PEER_TEXT_MAX];
+    const char *text = name != nullptr ? name : peer_text(addr, buf);
+    std::cout << "New client [" << text << "].\n";
+    APPROX_PROBE2(accept, client_fd, text);
+    engine.open(client_fd);
+    // Budujemy na miejscu w mapie: kopia client_info to kolejne alokacje
+    // kolejek na każde połączenie.
+    clients.erase(client_fd);
+    client_info &info = clients[client_fd];
+    info.socket_fd = client_fd;
+    info.addr = addr;
+    if (name != nullptr) info.addr_text = name;
+    info.connect_time = server_now();
+    info.byte_bucket = {byte_rate, info.connect_time};
+    info.msg_bucket = {msg_rate, info.connect_time};
+    if (journal_enabled())
+        journal_event(JournalEvent::Connect, client_fd, 0, 0.0, text);
+    std::cout << "New client: " << text << "\n";
+}
+
+// ---------------------------------------------------------------------
+// Klienci lokalni przez pamięć współdzieloną (-L)
+// ---------------------------------------------------------------------
+
+// Boty na tej samej maszynie łączą się z gniazdem uniksowym spod -L
+// i dostają pierścienie z approx-shm.h. W pętli zdarzeń są zwykłymi
+// klientami: kluczem jest eventfd, którym nas budzą, a gniazdo uniksowe
+// pilnujemy tylko pod kątem rozłączenia.
+
+static int create_local_socket() {
+    sockaddr_un sa{};
+    if (local_path.size() >= sizeof(sa.sun_path)) {
+        print_error("Za długa ścieżka dla -L: " + local_path);
+        return -1;
+    }
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path, local_path.c_str(), local_path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    unlink(local_path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        print_error("Nie udało się nasłuchiwać na " + local_path);
+        close(fd);
+        return -1;
+    }
+    std::cout << "Listening on local socket: " << local_path << std::endl;
+    return fd;
+}
+
+// Mapuje kanał klienta lokalnego i dopina go do client_info.
+static bool attach_local_channel(client_info &info, int ctrl_fd, int memfd,
+    int wake_fd) {
+    void *mem = mmap(nullptr, sizeof(shm_channel), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, memfd, 0);
+    if (mem == MAP_FAILED) return false;
+    info.shm = static_cast<shm_channel*>(mem);
+    info.shm_ctrl_fd = ctrl_fd;
+    info.shm_memfd = memfd;
+    info.shm_wake_fd = wake_fd;
+    local_ctrl_owner[ctrl_fd] = info.socket_fd;
+    return true;
+}
+
+// Zwraca false, gdy nikt więcej nie czeka na przyjęcie.
+static bool accept_local_client() {
+    int ctrl;
+    do {
+        ctrl = accept4(local_listen_fd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (ctrl < 0 && (errno == EINTR || errno == ECONNABORTED));
+    if (ctrl < 0) return false;
+    int memfd = memfd_create("approx-shm", MFD_CLOEXEC);
+    int wake_server = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int wake_client = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    void *mem = MAP_FAILED;
+    if (memfd >= 0 && ftruncate(memfd, sizeof(shm_channel)) == 0) {
+        mem = mmap(nullptr, sizeof(shm_channel), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, memfd, 0);
+    }
+    shm_handshake hs{};
+    memcpy(hs.magic, SHM_MAGIC, sizeof(hs.magic));
+    hs.version = SHM_VERSION;
+    hs.size = sizeof(shm_channel);
+    int fds[SHM_HANDSHAKE_FDS] = {memfd, wake_server, wake_client};
+    bool ok = mem != MAP_FAILED && wake_server >= 0 && wake_client >= 0;
+    if (ok) {
+        shm_channel *ch = new (mem) shm_channel();
+        memcpy(ch->magic, SHM_MAGIC, sizeof(ch->magic));
+        ch->version = SHM_VERSION;
+        ch->ring_size = SHM_RING_SIZE;
+        munmap(mem, sizeof(shm_channel));
+        ok = send_with_fds(ctrl, &hs, sizeof(hs), fds, SHM_HANDSHAKE_FDS);
+    } else if (mem != MAP_FAILED) {
+        munmap(mem, sizeof(shm_channel));
+    }
+    if (!ok) {
+        print_error("Nie udało się przygotować klienta lokalnego");
+        for (int fd : {ctrl, memfd, wake_server, wake_client})
+            if (fd >= 0) close(fd);
+        return true;
+    }
+
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    getsockopt(ctrl, SOL_SOCKET, SO_PEERCRED, &cred, &len);
+    std::string name = "local:" + std::to_string(cred.pid);
+    register_client(wake_server, sockaddr_storage{}, name.c_str());
+    if (!attach_local_channel(clients[wake_server], ctrl, memfd,
+                              wake_client)) {
+        print_error("mmap() kanału lokalnego nie powiódł się");
+        close(ctrl);
+        close(memfd);
+        close(wake_client);
+        close(wake_server);
+        forget_client(wake_server);
+    }
+    return true;
+}
+
+// Przenosi z pierścienia do net_buffer (w granicach --byte-rate
+// i --tick-bytes) i przetwarza najwyżej `budget` pełnych linii. Zwraca
+// liczbę przeczytanych bajtów.
+static size_t read_local_client(int fd, int budget = INT_MAX) {
+    client_info &info = clients[fd];
+    size_t want = recv_buffer.size();
+    if (byte_rate > 0) {
+        info.byte_bucket.refill(byte_rate, server_now());
+        want = std::min(want, static_cast<size_t>(info.byte_bucket.tokens));
+    }
+    size_t n = 0;
+    if (!shm_ring_read(info.shm->to_server, recv_buffer.data(), want, n)) {
+        info.shm_broken = true;
+        return 0;
+    }
+    if (n > 0) {
+        if (n == recv_buffer.size()) budget_stats.byte_hits++;
+        if (byte_rate > 0) info.byte_bucket.tokens -= n;
+        info.net_buffer.append(recv_buffer.data(), n);
+    }
+    if (!info.net_buffer.empty()) process_client_buffer(fd, budget);
+    return n;
+}
 
-    for (const auto& [fd, info] : clients) {
-        pollfds.push_back({fd, POLLIN, 0});
+// Przed zaśnięciem w poll() zgłasza wszystkim klientom lokalnym, że trzeba
+// nas budzić. Zwraca false, jeśli któryś pierścień ma już dane do
+// przeczytania.
+static bool local_clients_idle() {
+    auto now = server_now();
+    for (auto &[fd, info] : clients) {
+        if (info.shm == nullptr || client_throttled(info, now)) continue;
+        if (!shm_ring_prepare_sleep(info.shm->to_server)) return false;
+    }
+    return true;
+}
+
+// Przyjmuje wszystkie czekające połączenia naraz, aż do EAGAIN: na starcie
+// gry wszyscy gracze łączą się jednocześnie, a pojedynczy accept() na
+// obrót pętli kazałby ostatnim czekać setki obrotów. accept4() od razu
+// ustawia O_NONBLOCK, bez dwóch wywołań fcntl(). Zwraca liczbę
+// przyjętych.
+static int accept_tcp_clients(int listen_fd) {
+    int accepted = 0;
+    while (true) {
+        sockaddr_storage client_addr{};
+        socklen_t addrlen = sizeof(client_addr);
+        int client_fd = accept4(listen_fd, (sockaddr*)&client_addr, &addrlen,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // EAGAIN, albo EMFILE/ENOBUFS: spróbujemy w kolejnym obrocie.
+            return accepted;
+        }
+        register_client(client_fd, client_addr);
+        apply_low_latency_socket_options(client_fd);
+        ++accepted;
     }
 }
 
 void accept_new_clients(std::vector<pollfd>& pollfds,
     int listen_fd6, int listen_fd4) {
+    int accepted = 0;
     for (const pollfd& pfd : pollfds) {
+        if (local_listen_fd != -1 && pfd.fd == local_listen_fd &&
+            (pfd.revents & POLLIN)) {
+            while (accept_local_client()) ++accepted;
+            continue;
+        }
         if ((listen_fd6 != -1 && pfd.fd == listen_fd6 &&
             (pfd.revents & POLLIN)) || (listen_fd4 != -1 &&
                 pfd.fd == listen_fd4 && (pfd.revents & POLLIN))) {
-            sockaddr_storage client_addr{};
-            socklen_t addrlen = sizeof(client_addr);
-            int client_fd = accept(pfd.fd, (sockaddr*)&client_addr, &addrlen);
-            if (client_fd >= 0) {
-                set_nonblocking(client_fd);
-                std::string key = peer_key(client_addr);
-                std::cout << "New client [" << key << "].\n";
-                client_info info;
-                info.approx = std::vector<double>(K + 1, 0);
-                info.socket_fd = client_fd;
-                info.addr = client_addr;
-                info.addr_text = key;
-                info.connect_time = std::chrono::steady_clock::now();
-                clients[client_fd] = info;
-                std::cout << "New client: " << key << std::endl;
-            }
-            }
+            accepted += accept_tcp_clients(pfd.fd);
+        }
     }
+    // Logi "New client" idą jednym zapisem na całą partię.
+    if (accepted > 0) std::cout.flush();
 }
 
+// Każdy klient dostaje w jednym obrocie najwyżej --tick-bytes bajtów
+// odczytu i --tick-msgs linii; resztę obsłużymy w kolejnym obrocie, który
+// wtedy nie czeka w poll(). Początek obchodu przesuwa się co obrót, żeby
+// klient z najniższym fd nie był zawsze pierwszy.
+static size_t round_robin_start = 0;
+
 void handle_clients(const std::vector<pollfd>& pollfds,
     int listen_fd6, int listen_fd4) {
     std::vector<int> to_remove;
-
-    for (size_t i = (listen_fd6 != -1) +
-        (listen_fd4 != -1); i < pollfds.size(); ++i) {
-        const pollfd& pfd = pollfds[i];
-        if (pfd.revents & POLLIN) {
-            char buf[4096];
-            ssize_t recvd = recv(pfd.fd, buf, sizeof(buf), 0);
+    size_t first = (listen_fd6 != -1) + (listen_fd4 != -1) +
+        (local_listen_fd != -1);
+    size_t count = pollfds.size() - first;
+    size_t rotate = count > 0 ? round_robin_start++ % count : 0;
+
+    for (size_t j = 0; j < count; ++j) {
+        const pollfd& pfd = pollfds[first + (rotate + j) % count];
+        auto it = clients.find(pfd.fd);
+        if (it == clients.end()) {
+            // Gniazdo kontrolne klienta lokalnego: klient nic tu nie pisze,
+            // więc każde zdarzenie poza EAGAIN to rozłączenie.
+            auto owner = local_ctrl_owner.find(pfd.fd);
+            if (owner == local_ctrl_owner.end() || pfd.revents == 0)
+                continue;
+            char c;
+            if (recv(pfd.fd, &c, 1, 0) < 0 &&
+                (errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+            int key = owner->second;
+            // To, co klient zdążył zapisać przed wyjściem, jeszcze liczymy.
+            while (clients.find(key) != clients.end() &&
+                   read_local_client(key) > 0) {}
+            if (clients.find(key) == clients.end()) continue;
+            close_client_socket(key);
+            std::cout << "Client disconnected: "
+            << client_name(clients[key]) << std::endl;
+            to_remove.push_back(key);
+            continue;
+        }
+        client_info &info = it->second;
+        if (info.shm != nullptr) {
+            // Pierścień sprawdzamy w każdym obrocie: gdy pętla nie śpi,
+            // klient nas nie budzi.
+            if (pfd.revents & POLLIN) shm_clear_eventfd(pfd.fd);
+            if (!info.outbound.empty()) flush_outbound(info);
+            if (pfd.events & POLLIN)
+                read_local_client(pfd.fd, tick_msg_budget);
+            else if (!info.net_buffer.empty())
+                process_client_buffer(pfd.fd, tick_msg_budget);
+            auto again = clients.find(pfd.fd);
+            if (again != clients.end() && again->second.shm_broken)
+                shed_client(pfd.fd, "corrupt shared-memory ring");
+            continue;
+        }
+        // POLLERR może oznaczać tylko potwierdzenia zero-copy w kolejce
+        // błędów; prawdziwy błąd gniazda zgłosi SO_ERROR. Po zebraniu
+        // potwierdzeń obsługujemy resztę zdarzeń z tego samego obrotu.
+        short revents = pfd.revents;
+        if ((revents & POLLERR) &&
+            (info.zerocopy || !info.zc_inflight.empty())) {
+            reap_zerocopy_completions(info);
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(pfd.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err == 0 && !(revents & POLLHUP)) {
+                revents &= ~POLLERR;
+                // Zwolnione bufory mogą odblokować kolejkę.
+                if (!(revents & POLLOUT) && !info.outbound.empty())
+                    flush_outbound(info);
+            }
+        }
+        if ((revents & POLLOUT) && !flush_outbound(info)) {
+            print_error("Błąd wysyłania wiadomości " + client_name(info));
+            info.outbound.clear();
+        }
+        if (revents & POLLIN) {
+            char *buf = recv_buffer.data();
+            size_t want = recv_buffer.size();
+            if (byte_rate > 0) {
+                info.byte_bucket.refill(byte_rate, server_now());
+                want = std::min(want,
+                    static_cast<size_t>(info.byte_bucket.tokens));
+                if (want == 0) continue;
+            }
+            ssize_t recvd = recv(pfd.fd, buf, want, 0);
+            if (recvd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
             if (recvd <= 0) {
-                close(pfd.fd);
+                // Linie odłożone przez budżet obrotu obsługujemy jeszcze
+                // przed rozłączeniem.
+                if (info.backlog && !process_client_buffer(pfd.fd)) continue;
+                close_client_socket(pfd.fd);
                 std::cout << "Client disconnected: "
-                << clients[pfd.fd].addr_text << std::endl;
+                << client_name(info) << std::endl;
                 to_remove.push_back(pfd.fd);
             } else {
-                clients[pfd.fd].net_buffer.append(buf, recvd);
-                process_client_buffer(pfd.fd);
+                if (static_cast<size_t>(recvd) == recv_buffer.size())
+                    budget_stats.byte_hits++;
+                if (byte_rate > 0) info.byte_bucket.tokens -= recvd;
+                info.net_buffer.append(buf, recvd);
+                process_client_buffer(pfd.fd, tick_msg_budget);
             }
+        } else if (revents & (POLLHUP | POLLERR)) {
+            close_client_socket(pfd.fd);
+            std::cout << "Client disconnected: "
+            << client_name(info) << std::endl;
+            to_remove.push_back(pfd.fd);
+        } else if (!info.net_buffer.empty()) {
+            // Linie wstrzymane przez --msg-rate albo budżet obrotu.
+            process_client_buffer(pfd.fd, tick_msg_budget);
         }
     }
 
     for (int fd : to_remove) {
-        currM += clients[fd].sent_put;
-        clients.erase(fd);
+        forget_client(fd);
+    }
+}
+
+// Zamyka połączenia, które nie przysłały HELLO w ciągu TIMEOUT sekund.
+static void reap_stale_connections() {
+    auto now = server_now();
+    std::vector<int> stale;
+    for (const auto &[fd, info] : clients) {
+        if (!info.spectator &&
+            engine.player(fd).state == State::AwaitingHello &&
+            now - info.connect_time > std::chrono::seconds(TIMEOUT))
+            stale.push_back(fd);
+    }
+    for (int fd : stale) shed_client(fd, "no HELLO in time");
+}
+
+static int ms_until(std::chrono::steady_clock::time_point t,
+    std::chrono::steady_clock::time_point now) {
+    if (t <= now) return 0;
+    return static_cast<int>(std::chrono::duration_cast<
+        std::chrono::milliseconds>(t - now).count()) + 1;
+}
+
+// Najbliższy termin, na który pętla musi się obudzić sama: opóźniony
+// STATE, koniec czasu na HELLO, uzupełnienie żetonów, migawka, ranking
+// dla widzów, zaległa praca ponad budżet obrotu.
+// W trybie niskich opóźnień nie czekamy wcale.
+static int poll_timeout() {
+    if (low_latency) return 0;
+    auto now = server_now();
+    int timeout = checkpoint_poll_timeout();
+    auto earlier = [&timeout](int ms) {
+        if (ms >= 0 && (timeout < 0 || ms < timeout)) timeout = ms;
+    };
+    earlier(spectator_poll_timeout());
+    std::chrono::steady_clock::time_point due;
+    if (engine.next_due(due)) earlier(ms_until(due, now));
+    for (auto &[fd, info] : clients) {
+        if (!info.spectator &&
+            engine.player(fd).state == State::AwaitingHello) {
+            earlier(ms_until(info.connect_time +
+                std::chrono::seconds(TIMEOUT), now));
+        }
+        // Budzimy się, gdy przybędzie następny żeton.
+        if (byte_rate > 0) {
+            info.byte_bucket.refill(byte_rate, now);
+            if (info.byte_bucket.tokens < 1.0)
+                earlier(info.byte_bucket.ms_to_token(byte_rate));
+        }
+        if (msg_rate > 0 && !info.net_buffer.empty() &&
+            info.msg_bucket.tokens < 1.0)
+            earlier(info.msg_bucket.ms_to_token(msg_rate));
+        // Linie ponad budżet poprzedniego obrotu: bez czekania.
+        if (info.backlog) earlier(0);
+        // Pełny pierścień do klienta lokalnego: sprawdzamy, czy się zwolnił.
+        if (info.shm != nullptr && !info.outbound.empty()) earlier(1);
     }
+    return timeout;
 }
 
 static void send_pending_responses() {
-    auto now = std::chrono::steady_clock::now();
-    for (auto &kv : clients) {
-        auto &info = kv.second;
+    engine.drain_due_states(server_now(),
+        [](int key, const approx_player &player) {
+        client_info &info = clients[key];
+        std::cout << "Sending state";
+        log_state(player.approx);
+        std::cout << " to " << player.username << ".\n";
+        journal_event(JournalEvent::StateSent, info.socket_fd);
+        APPROX_PROBE4(state_sent, key, player.username.c_str(),
+                      probe_ns(player.put_time), probe_ns(player.send_time));
+        if (!send_state(info, key)) {
+            print_error("Błąd wysyłania wiadomości " + client_name(info));
+        }
+        if (low_latency) {
+            auto late = std::chrono::steady_clock::now() - player.put_time -
+                std::chrono::seconds(player.lowercase);
+            state_latency.record(std::max<int64_t>(0,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    late).count()));
+        }
+    });
+}
 
-        if (info.has_pending && now >= info.send_time) {
-            std::cout << "Sending state";
-            for (int x = 0; x <= K; ++x) {
-                std::cout << " " << info.approx[x];
-            }
-            std::cout << " to " << info.username << ".\n";
-            const std::string &msg = info.pending_response;
-            ssize_t sent = send(info.socket_fd, msg.c_str(), msg.size(), 0);
-            if (sent < 0) {
-                print_error("Błąd wysyłania wiadomości " + info.addr_text);
-            }
-            info.has_pending = false;
-            info.pending_response.clear();
+// ---------------------------------------------------------------------
+// Przekazanie gniazd nowemu procesowi serwera (SIGUSR2)
+// ---------------------------------------------------------------------
+
+// Po SIGUSR2 serwer uruchamia następcę (ten sam lub wskazany przez -U
+// plik wykonywalny) z --inherit i przez parę gniazd Unix przekazuje mu
+// gniazda nasłuchujące, a domyślnie także gniazda klientów razem
+// z zserializowanym client_info. Połączenia czekające w kolejce accept
+// trafiają do następcy, więc żadne nie zostaje odrzucone.
+// Z --handover-listen-only przekazywane są tylko gniazda nasłuchujące,
+// a stary proces kończy bieżącą grę ze swoimi klientami.
+
+static volatile sig_atomic_t handover_requested = 0;
+
+// Następca po przekazaniu samych gniazd nasłuchujących: gniazdo od
+// poprzednika zostaje otwarte, dopóki ten nie skończy swojej gry.
+static int predecessor_fd = -1;
+static int64_t predecessor_journal_start_ns = 0;
+
+static constexpr char HANDOVER_MAGIC[4] = {'A', 'P', 'X', 'H'};
+static constexpr uint32_t HANDOVER_VERSION = 7;
+
+struct handover_header {
+    char magic[4];
+    uint32_t version;
+    int32_t k, n, m, curr_m;
+    int64_t coeff_offset;
+    int64_t journal_start_ns;
+    int64_t game_start_ns;  // 0: następca zaczyna nową grę
+    uint32_t client_count;
+    uint8_t has_listen6;
+    uint8_t has_listen4;
+    uint8_t has_local;   // gniazdo uniksowe spod -L
+    uint8_t listen_only; // --handover-listen-only: poprzednik kończy grę
+};
+
+static void on_handover_signal(int) {
+    handover_requested = 1;
+}
+
+static int64_t steady_ns(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        t.time_since_epoch()).count();
+}
+
+static std::chrono::steady_clock::time_point steady_from_ns(int64_t ns) {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::nanoseconds(ns));
+}
+
+struct handover_writer {
+    std::string data{};
+
+    template <typename T>
+    void put(const T &v) {
+        data.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+    void put_string(const std::string &v) {
+        put<uint64_t>(v.size());
+        data += v;
+    }
+    void put_doubles(const std::vector<double> &v) {
+        put<uint64_t>(v.size());
+        data.append(reinterpret_cast<const char*>(v.data()),
+                    v.size() * sizeof(double));
+    }
+    // approx przechodzi w swojej bieżącej reprezentacji.
+    void put_approx(const approx_store &a) {
+        put<int32_t>(a.k());
+        put<uint8_t>(a.dense());
+        if (a.dense()) {
+            put_doubles(a.values());
+            return;
+        }
+        put<uint64_t>(a.sparse().size());
+        data.append(reinterpret_cast<const char*>(a.sparse().data()),
+                    a.sparse().size() * sizeof(a.sparse()[0]));
+    }
+};
+
+struct handover_reader {
+    const std::string &data;
+    size_t off{0};
+    bool ok{true};
+
+    template <typename T>
+    void get(T &v) {
+        if (off + sizeof(T) > data.size()) {
+            ok = false;
+            return;
+        }
+        memcpy(&v, data.data() + off, sizeof(T));
+        off += sizeof(T);
+    }
+    void get_string(std::string &v) {
+        uint64_t len = 0;
+        get(len);
+        if (!ok || off + len > data.size()) {
+            ok = false;
+            return;
         }
+        v.assign(data.data() + off, len);
+        off += len;
     }
+    void get_doubles(std::vector<double> &v) {
+        uint64_t len = 0;
+        get(len);
+        if (!ok || off + len * sizeof(double) > data.size()) {
+            ok = false;
+            return;
+        }
+        v.resize(len);
+        memcpy(v.data(), data.data() + off, len * sizeof(double));
+        off += len * sizeof(double);
+    }
+    void get_approx(approx_store &a) {
+        int32_t k = 0;
+        uint8_t dense = 0;
+        get(k);
+        get(dense);
+        if (dense) {
+            std::vector<double> v;
+            get_doubles(v);
+            a.load_dense(k, std::move(v));
+            return;
+        }
+        uint64_t len = 0;
+        get(len);
+        using entry = std::pair<int, double>;
+        if (!ok || off + len * sizeof(entry) > data.size()) {
+            ok = false;
+            return;
+        }
+        std::vector<entry> v(len);
+        memcpy(static_cast<void*>(v.data()), data.data() + off,
+               len * sizeof(entry));
+        off += len * sizeof(entry);
+        a.load_sparse(k, std::move(v));
+    }
+};
+
+static std::string serialize_client(const client_info &info,
+    const approx_player &player) {
+    handover_writer w;
+    w.put_string(player.username);
+    w.put(steady_ns(info.connect_time));
+    w.put(info.addr);
+    w.put_string(client_name(info));
+    w.put(player.state);
+    w.put_doubles(player.coeffs);
+    w.put_approx(player.approx);
+    w.put(player.penalty);
+    w.put(player.puts_count);
+    w.put_string(info.net_buffer);
+    w.put(player.lowercase);
+    w.put(player.sent_put);
+    w.put(steady_ns(player.send_time));
+    w.put(steady_ns(player.put_time));
+    w.put(player.has_pending);
+    w.put(info.checkpoint_slot);
+    w.put(info.checkpoint_dirty);
+    // Niewysłana reszta kolejki wyjściowej przechodzi jako jeden blok;
+    // licznik zero-copy jądra jest związany z gniazdem, więc też jedzie.
+    std::string unsent;
+    for (const outbound_segment &seg : info.outbound) {
+        unsent.append(*seg.data, seg.offset, std::string::npos);
+        // Niedokończony STATE dokodowujemy tu do końca.
+        if (!seg.stream) continue;
+        state_stream rest = *seg.stream;
+        while (!rest.done()) unsent += *next_state_chunk(rest);
+    }
+    w.put_string(unsent);
+    w.put(info.zc_seq);
+    w.put(info.spectator);
+    return std::move(w.data);
 }
 
-static void end_game_and_reset() {
-    // Wynik każdego klienta: ∑_{x=0..K} (approx[x] – f(x))^2  + penalty
-    std::vector<std::pair<std::string, double>> results;
-    results.reserve(clients.size());
+static bool deserialize_client(const std::string &data, client_info &info,
+    approx_player &player) {
+    handover_reader r{data};
+    int64_t connect_ns = 0, send_ns = 0, put_ns = 0;
+    r.get_string(player.username);
+    r.get(connect_ns);
+    r.get(info.addr);
+    r.get_string(info.addr_text);
+    r.get(player.state);
+    r.get_doubles(player.coeffs);
+    r.get_approx(player.approx);
+    r.get(player.penalty);
+    r.get(player.puts_count);
+    r.get_string(info.net_buffer);
+    r.get(player.lowercase);
+    r.get(player.sent_put);
+    r.get(send_ns);
+    r.get(put_ns);
+    r.get(player.has_pending);
+    r.get(info.checkpoint_slot);
+    r.get(info.checkpoint_dirty);
+    std::string unsent;
+    r.get_string(unsent);
+    if (!unsent.empty()) {
+        info.outbound.push_back(
+            {std::make_shared<const std::string>(std::move(unsent)), 0});
+    }
+    r.get(info.zc_seq);
+    r.get(info.spectator);
+    // Zegar monotoniczny jest wspólny dla procesów, więc czasy
+    // przenosimy bez przeliczania.
+    info.connect_time = steady_from_ns(connect_ns);
+    player.send_time = steady_from_ns(send_ns);
+    player.put_time = steady_from_ns(put_ns);
+    return r.ok && r.off == data.size();
+}
 
-    for (auto &kv : clients) {
-        auto &info = kv.second;
+// Uruchamia następcę i przekazuje mu stan. Zwraca true, jeśli następca
+// potwierdził przejęcie; wtedy ten proces powinien się wycofać.
+static bool perform_handover(int &listen_fd6, int &listen_fd4) {
+    std::cout << "Handing over to " << server_binary << ".\n";
+    // Z klientami pliki dziennika i migawki przejmuje następca, więc
+    // zamykamy je tutaj. Przy samych gniazdach nasłuchujących zostają
+    // u nas do końca gry, a następca otworzy je, gdy się zakończymy.
+    bool with_clients = !handover_listen_only;
+    int64_t journal_start = steady_ns(journal.start);
+    bool had_journal = journal_enabled();
+    bool had_checkpoint = checkpoint_enabled();
+    bool had_results = results_enabled();
+    if (with_clients) {
+        checkpoint_close();
+        journal_close();
+    }
+    results_close();
+
+    // Argumenty następcy przygotowujemy przed fork(): wątki zapisujące
+    // mogą wciąż działać, więc dziecko nie może już alokować pamięci.
+    std::vector<std::string> args = server_args;
+    args.push_back("--inherit");
+    args.push_back("3");
+    std::vector<char*> cargs;
+    cargs.push_back(const_cast<char*>(server_binary.c_str()));
+    for (std::string &a : args) cargs.push_back(a.data());
+    cargs.push_back(nullptr);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        print_error("socketpair() nie powiódł się");
+        return false;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    pid_t pid = fork();
+    if (pid < 0) {
+        print_error("fork() nie powiódł się");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Następca dostaje wyłącznie stdio i gniazdo przekazania jako fd 3.
+        dup2(sv[1], 3);
+        close_range(4, ~0U, 0);
+        execv(server_binary.c_str(), cargs.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    int sock = sv[0];
+
+    // Klienci bez HELLO zostają u nas, więc odkładamy dla nich linie
+    // COEFF, a następca zaczyna czytać plik za nimi.
+    int64_t coeff_offset = coeff_file_offset();
+    if (!with_clients) {
+        for (const auto &[fd, info] : clients) {
+            std::string line;
+            if (info.spectator ||
+                engine.player(fd).state != State::AwaitingHello ||
+                !std::getline(coeff_file, line))
+                continue;
+            reserved_coeff_lines.push(std::move(line));
+        }
+    }
+
+    handover_header hdr{};
+    memcpy(hdr.magic, HANDOVER_MAGIC, sizeof(hdr.magic));
+    hdr.version = HANDOVER_VERSION;
+    hdr.k = K;
+    hdr.n = N;
+    hdr.m = M;
+    hdr.curr_m = with_clients ? currM : M;
+    hdr.coeff_offset = coeff_file_offset();
+    hdr.journal_start_ns = had_journal ? journal_start : 0;
+    hdr.game_start_ns = with_clients ? game_start_ns : 0;
+    hdr.client_count = with_clients ? clients.size() : 0;
+    hdr.has_listen6 = listen_fd6 != -1;
+    hdr.has_listen4 = listen_fd4 != -1;
+    hdr.has_local = local_listen_fd != -1;
+    hdr.listen_only = !with_clients;
+    int lfds[3];
+    int nl = 0;
+    if (listen_fd6 != -1) lfds[nl++] = listen_fd6;
+    if (listen_fd4 != -1) lfds[nl++] = listen_fd4;
+    if (local_listen_fd != -1) lfds[nl++] = local_listen_fd;
+
+    bool ok = send_with_fds(sock, &hdr, sizeof(hdr), lfds, nl);
+    if (with_clients) {
+        for (auto it = clients.begin(); ok && it != clients.end(); ++it) {
+            const client_info &info = it->second;
+            // Widz nie ma stanu gry, przechodzi z pustym graczem.
+            std::string blob = serialize_client(info, info.spectator ?
+                approx_player{} : engine.player(it->first));
+            uint64_t len = blob.size();
+            // Klient lokalny przechodzi z gniazdem kontrolnym, memfd
+            // i obydwoma eventfd.
+            int cfds[MAX_PASSED_FDS] = {info.socket_fd, info.shm_ctrl_fd,
+                                        info.shm_memfd, info.shm_wake_fd};
+            int ncfds = info.shm != nullptr ? 4 : 1;
+            ok = send_with_fds(sock, &len, sizeof(len), cfds, ncfds) &&
+                 write_all(sock, blob.data(), blob.size());
+        }
+    }
+    char ack = 0;
+    if (ok) {
+        pollfd pfd{sock, POLLIN, 0};
+        ok = poll(&pfd, 1, 5000) == 1 && read(sock, &ack, 1) == 1 &&
+             ack == 'K';
+    }
+    if (!ok) {
+        close(sock);
+        print_error("Następca nie przejął gniazd, kontynuuję");
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        if (with_clients && had_journal && journal_open(true))
+            journal.start = steady_from_ns(journal_start);
+        if (with_clients && had_checkpoint) checkpoint_reattach();
+        if (had_results) results_open(true);
+        reserved_coeff_lines = {};
+        coeff_file.seekg(coeff_offset);
+        return false;
+    }
+    if (with_clients) {
+        close(sock);
+        return true;
+    }
+    // Bieżącą grę kończymy sami i jej wynik też dopisujemy; następca ma
+    // już plik otwarty, ale każdy blok to jedno write() z O_APPEND.
+    if (had_results) results_open(true);
+
+    // Tylko gniazda nasłuchujące: dokończ grę z obecnymi klientami.
+    // Gniazdo przekazania zamknie dopiero wyjście procesu, po zamknięciu
+    // dziennika i migawki; po tym następca poznaje, że są wolne.
+    close(listen_fd6);
+    close(listen_fd4);
+    listen_fd6 = listen_fd4 = -1;
+    if (local_listen_fd != -1) close(local_listen_fd);
+    local_listen_fd = -1;
+    handover_draining = true;
+    std::cout << "Listening sockets handed over, finishing current game.\n";
+    return false;
+}
 
-        double sum_squares = 0.0;
-        for (int x = 0; x <= K; ++x) {
-            // Oblicz f(x) = a[0] + a[1]*x + a[2]*x^2 + … + a[N]*x^N
-            double fx = 0.0;
-            double x_pow = 1.0;
-            for (int i = 0; i <= N; ++i) {
-                fx += kv.second.coeffs[i] * x_pow;
-                x_pow *= static_cast<double>(x);
+// Strona następcy: odbiera stan od poprzednika (fd z --inherit).
+static bool receive_handover(int &listen_fd6, int &listen_fd4) {
+    handover_header hdr{};
+    int lfds[3];
+    int nl = 0;
+    if (!recv_with_fds(inherit_fd, &hdr, sizeof(hdr), lfds, 3, nl) ||
+        memcmp(hdr.magic, HANDOVER_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != HANDOVER_VERSION ||
+        nl != hdr.has_listen6 + hdr.has_listen4 + hdr.has_local) {
+        print_error("Niepoprawne dane przekazania");
+        return false;
+    }
+    K = hdr.k;
+    N = hdr.n;
+    M = hdr.m;
+    currM = hdr.curr_m;
+    engine.configure(K, N);
+    int li = 0;
+    listen_fd6 = hdr.has_listen6 ? lfds[li++] : -1;
+    listen_fd4 = hdr.has_listen4 ? lfds[li++] : -1;
+    local_listen_fd = hdr.has_local ? lfds[li++] : -1;
+    for (uint32_t i = 0; i < hdr.client_count; ++i) {
+        uint64_t len = 0;
+        int cfds[MAX_PASSED_FDS];
+        int nfds = 0;
+        if (!recv_with_fds(inherit_fd, &len, sizeof(len), cfds,
+                           MAX_PASSED_FDS, nfds) ||
+            (nfds != 1 && nfds != 4)) {
+            print_error("Niepoprawne dane klienta w przekazaniu");
+            return false;
+        }
+        std::string blob(len, '\0');
+        client_info info;
+        approx_player player;
+        if (!read_all(inherit_fd, blob.data(), len) ||
+            !deserialize_client(blob, info, player)) {
+            print_error("Niepoprawne dane klienta w przekazaniu");
+            return false;
+        }
+        int cfd = cfds[0];
+        info.socket_fd = cfd;
+        if (nfds == 4) {
+            if (!attach_local_channel(info, cfds[1], cfds[2], cfds[3])) {
+                print_error("mmap() kanału lokalnego nie powiódł się");
+                return false;
             }
-            double diff = info.approx[x] - fx;
-            sum_squares += diff * diff;
+        } else {
+            // Poprzednik mógł zostawić w kolejce błędów potwierdzenia
+            // zero-copy, więc tu nie czekamy z włączeniem.
+            info.zerocopy = enable_zerocopy(cfd);
+            info.zerocopy_probed = true;
+            apply_low_latency_socket_options(cfd);
+        }
+        if (info.spectator) spectators.insert(cfd);
+        else engine.open(cfd) = std::move(player);
+        clients[cfd] = std::move(info);
+    }
+
+    coeff_file.seekg(hdr.coeff_offset);
+    if (hdr.listen_only) {
+        // Dziennik i migawkę poprzednik pisze do końca swojej gry;
+        // przejmiemy je w adopt_predecessor_files().
+        predecessor_journal_start_ns = hdr.journal_start_ns;
+    } else {
+        if (!checkpoint_path.empty() && !checkpoint_reattach()) return false;
+        if (!journal_path.empty()) {
+            if (!journal_open(hdr.journal_start_ns != 0)) return false;
+            if (hdr.journal_start_ns != 0)
+                journal.start = steady_from_ns(hdr.journal_start_ns);
         }
+    }
+    // Poprzednik zamknął plik wyników przed fork(), więc możemy go
+    // sprawdzić; otworzy go ponownie dopiero po naszym potwierdzeniu.
+    if (!results_path.empty() && !results_open()) return false;
+    if (hdr.game_start_ns != 0) game_start_ns = hdr.game_start_ns;
+
+    char ack = 'K';
+    write_all(inherit_fd, &ack, 1);
+    if (hdr.listen_only) predecessor_fd = inherit_fd;
+    else close(inherit_fd);
+    std::cout << "Took over " << clients.size() << " clients, "
+              << currM << " PUTs left.\n";
+    return true;
+}
+
+// Po przekazaniu samych gniazd nasłuchujących, między grami: jeśli
+// poprzednik już wyszedł (koniec pliku na gnieździe przekazania),
+// otwieramy dziennik i zaczynamy od nowa migawkę. Gra rozegrana
+// równolegle z poprzednikiem nie trafia do dziennika.
+static void adopt_predecessor_files() {
+    if (predecessor_fd == -1) return;
+    pollfd pfd{predecessor_fd, POLLIN, 0};
+    char c;
+    if (poll(&pfd, 1, 0) != 1 || read(predecessor_fd, &c, 1) > 0) return;
+    close(predecessor_fd);
+    predecessor_fd = -1;
+    if (!checkpoint_path.empty()) {
+        resume = false;
+        if (checkpoint_open()) checkpoint_start_writer();
+    }
+    if (!journal_path.empty()) {
+        bool append = predecessor_journal_start_ns != 0;
+        if (journal_open(append) && append)
+            journal.start = steady_from_ns(predecessor_journal_start_ns);
+    }
+    std::cout << "Previous server finished, taking over journal and "
+                 "checkpoint.\n";
+}
 
-        double total_score = sum_squares + static_cast<double>(info.penalty);
-        results.emplace_back(info.username, total_score);
+// Przed zamknięciem gniazd dosyła zaległe dane i czeka na potwierdzenia
+// zero-copy, najdłużej do `deadline`.
+// Bufory zero-copy rozłączonych i niedokończonych klientów zostają
+// w zc_inflight; zwolni je dopiero close_client_socket().
+static void drain_outbound(std::chrono::steady_clock::time_point deadline) {
+    std::vector<pollfd> pfds;
+    std::set<int> hung_up;
+    while (true) {
+        pfds.clear();
+        bool local_pending = false;
+        for (auto &[fd, info] : clients) {
+            if (hung_up.count(fd)) continue;
+            if (info.shm != nullptr) {
+                // Pierścień klienta lokalnego sprawdzamy co 1 ms.
+                flush_outbound(info);
+                local_pending |= !info.outbound.empty();
+            } else if (!info.outbound.empty()) {
+                pfds.push_back({fd, POLLOUT, 0});
+            } else if (!info.zc_inflight.empty()) {
+                pfds.push_back({fd, 0, 0});
+            }
+        }
+        int left = ms_until(deadline, std::chrono::steady_clock::now());
+        if ((pfds.empty() && !local_pending) || left == 0) return;
+        int ready = poll(pfds.data(), pfds.size(),
+                         local_pending ? std::min(left, 1) : left);
+        if (ready < 0 || (ready == 0 && !local_pending)) return;
+        for (const pollfd &pfd : pfds) {
+            client_info &info = clients[pfd.fd];
+            if (pfd.revents & POLLERR) reap_zerocopy_completions(info);
+            if (pfd.revents & POLLHUP) {
+                info.outbound.clear();
+                hung_up.insert(pfd.fd);
+            } else if ((pfd.revents & POLLOUT) && !flush_outbound(info)) {
+                info.outbound.clear();
+            }
+        }
     }
+}
 
-    // 2) Posortuj według player_id (rosnąco, ASCII)
-    std::sort(results.begin(), results.end(),
-              [](auto &p1, auto &p2) {
-                  return p1.first < p2.first;
-              });
+static void end_game_and_reset() {
+    // Wynik każdego klienta: ∑_{x=0..K} (approx[x] – f(x))^2  + penalty,
+    // posortowane według player_id (rosnąco, ASCII)
+    std::vector<player_result> results = engine.results();
+    APPROX_PROBE2(game_end, static_cast<int>(results.size()), M);
     std::cout << "Game end, scoring:";
     for (auto &pr : results) {
-        std::cout << " " << pr.first << " " << pr.second;
+        std::cout << " " << pr.username << " " << pr.score;
     }
     std::cout << ".\n";
+    report_latency();
+    report_work_budget();
+    results_record_game(results);
     std::ostringstream oss;
     oss << "SCORING";
     for (auto &pr : results) {
-        oss << " " << pr.first << " " << pr.second;
+        oss << " " << pr.username << " " << pr.score;
     }
+    journal_event(JournalEvent::Scoring, -1, 0, 0.0, oss.str());
     oss << "\r\n";
-    std::string scoring_msg = oss.str();
+    // Jedna kopia SCORING, współdzielona przez kolejki wszystkich klientów.
+    auto scoring_msg = std::make_shared<const std::string>(oss.str());
 
     // 4) Wyślij do wszystkich klientów, zamknij gniazda
     for (auto &kv : clients) {
         auto &info = kv.second;
-        ssize_t sent = send(info.socket_fd,
-            scoring_msg.c_str(), scoring_msg.size(), 0);
-        if (sent < 0) {
-            print_error("Błąd wysyłania SCORING do klienta " + info.addr_text);
+        if (!send_buffers(info, {scoring_msg})) {
+            print_error("Błąd wysyłania SCORING do klienta " +
+                        client_name(info));
+            info.outbound.clear();
         }
-        close(info.socket_fd);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    if (!replaying) drain_outbound(deadline);
+    for (auto &kv : clients) {
+        auto &info = kv.second;
+        close_client_socket(info.socket_fd);
+        checkpoint_release_slot(info.checkpoint_slot);
     }
     clients.clear();
-    sleep(1);
+    engine.clear();
+    spectators.clear();
+    spectator_events.clear();
+    for (const auto &[slot, sp] : saved_players)
+        checkpoint_release_slot(sp.slot);
+    saved_players.clear();
+    journal_flush();
+    if (!replaying) std::this_thread::sleep_until(deadline);
     currM = M;
+    game_start_ns = wall_now_ns();
+    adopt_predecessor_files();
+    checkpoint_tick(true);
+}
+
+// Odtwarza dziennik w procesie, przez te same funkcje obsługi co pętla
+// sieciowa. Zdarzenia wejściowe (połączenia, HELLO, PUT, rozłączenia)
+// są podawane handlerom, a STATE wysyłane są w nagranych chwilach.
+// Bez -P czas wirtualny przeskakuje od razu do kolejnego zdarzenia.
+static int run_replay() {
+    std::ifstream in(replay_path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    journal_file_header hdr{};
+    if (data.size() < sizeof(hdr)) {
+        print_error("Niepoprawny dziennik: " + replay_path);
+        return 1;
+    }
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    if (memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != JOURNAL_VERSION) {
+        print_error("Niepoprawny nagłówek dziennika: " + replay_path);
+        return 1;
+    }
+    K = hdr.k;
+    N = hdr.n;
+    M = currM = hdr.m;
+    engine.configure(K, N);
+    replay_wall_start_ns = hdr.wall_start_ns;
+    game_start_ns = wall_now_ns();
+
+    struct replay_event {
+        journal_record rec;
+        std::string payload;
+    };
+    std::vector<replay_event> events;
+    size_t off = sizeof(hdr);
+    while (off + sizeof(journal_record) <= data.size()) {
+        replay_event ev;
+        memcpy(&ev.rec, data.data() + off, sizeof(ev.rec));
+        off += sizeof(ev.rec);
+        if (off + ev.rec.len > data.size()) break;
+        ev.payload.assign(data.data() + off, ev.rec.len);
+        off += ev.rec.len;
+        if (static_cast<JournalEvent>(ev.rec.type) == JournalEvent::Coeff)
+            replay_coeff_lines.push(ev.payload);
+        events.push_back(std::move(ev));
+    }
+    if (off != data.size()) {
+        print_error("Dziennik ucięty, odtwarzam " +
+                    std::to_string(events.size()) + " pełnych zdarzeń");
+    }
+
+    if (!journal_path.empty() && !journal_open()) return 1;
+    if (!results_path.empty() && !results_open()) return 1;
+
+    auto real_start = std::chrono::steady_clock::now();
+    for (const replay_event &ev : events) {
+        auto at = std::chrono::nanoseconds(ev.rec.ts_ns);
+        replay_clock = std::chrono::steady_clock::time_point(at);
+        if (replay_paced) std::this_thread::sleep_until(real_start + at);
+
+        int fd = ev.rec.fd;
+        switch (static_cast<JournalEvent>(ev.rec.type)) {
+        case JournalEvent::Connect:
+            register_client(fd, sockaddr_storage{}, ev.payload.c_str());
+            break;
+        case JournalEvent::Hello:
+        case JournalEvent::Put:
+            if (clients.find(fd) != clients.end()) {
+                clients[fd].net_buffer += ev.payload + "\r\n";
+                process_client_buffer(fd);
+            }
+            break;
+        case JournalEvent::StateSent:
+            send_pending_responses();
+            break;
+        case JournalEvent::Disconnect:
+            if (clients.find(fd) != clients.end()) {
+                std::cout << "Client disconnected: "
+                << client_name(clients[fd]) << std::endl;
+                forget_client(fd);
+            }
+            break;
+        default:
+            // COEFF, BAD_PUT, PENALTY i SCORING są skutkami, nie wejściem.
+            break;
+        }
+        if (currM == 0) end_game_and_reset();
+        journal_flush();
+    }
+
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - real_start).count();
+    std::cerr << "Replayed " << events.size() << " events in " << secs
+              << " s (" << (secs > 0 ? events.size() / secs : 0.0)
+              << " events/s).\n";
+    journal_close();
+    results_close();
+    return 0;
 }
 
-void server_loop(int listen_fd6, int listen_fd4) {
+void server_loop(int &listen_fd6, int &listen_fd4) {
     std::vector<pollfd> pollfds;
 
     while (currM) {
+        if (handover_requested) {
+            handover_requested = 0;
+            if (perform_handover(listen_fd6, listen_fd4)) std::exit(0);
+        }
         prepare_pollfds(pollfds, listen_fd6, listen_fd4);
 
-        if (poll(pollfds.data(), pollfds.size(), -1) < 0) {
+        int timeout = poll_timeout();
+        if (timeout != 0 && !local_clients_idle()) timeout = 0;
+        if (poll(pollfds.data(), pollfds.size(), timeout) < 0) {
+            if (errno == EINTR) continue;
             print_error("poll() error");
             break;
         }
@@ -638,6 +3278,10 @@ void server_loop(int listen_fd6, int listen_fd4) {
 
         accept_new_clients(pollfds, listen_fd6, listen_fd4);
         handle_clients(pollfds, listen_fd6, listen_fd4);
+        spectator_tick();
+        reap_stale_connections();
+        journal_flush();
+        checkpoint_tick();
 
         pollfds.clear();  // clean pollfds for next loop
     }
@@ -650,29 +3294,75 @@ void server_loop(int listen_fd6, int listen_fd4) {
 void cleanup(int listen_fd6, int listen_fd4) {
     if (listen_fd6 != -1) close(listen_fd6);
     if (listen_fd4 != -1) close(listen_fd4);
+    // Po przekazaniu gniazd ścieżka należy już do następcy.
+    if (local_listen_fd != -1) {
+        close(local_listen_fd);
+        unlink(local_path.c_str());
+    }
 
     for (auto& [fd, _] : clients) {
-        close(fd);
+        close_client_socket(fd);
     }
 }
 
 
 
+// Zapamiętuje, jak uruchomić następcę przy przekazaniu gniazd.
+static void remember_invocation(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--inherit" && i + 1 < argc) {
+            ++i;
+            continue;
+        }
+        server_args.push_back(argv[i]);
+    }
+    if (server_binary.empty()) {
+        char path[PATH_MAX];
+        if (realpath(argv[0], path) != nullptr) {
+            server_binary = path;
+        } else {
+            ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+            path[len > 0 ? len : 0] = '\0';
+            server_binary = path;
+        }
+    }
+    struct sigaction sa{};
+    sa.sa_handler = on_handover_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, nullptr);
+}
+
 int main(int argc, char* argv[]) {
     if (!initialize(argc, argv)) return 1;
+    if (replaying) return run_replay();
+    remember_invocation(argc, argv);
 
-    int listen_fd6 = create_server_socket(AF_INET6);
-    int listen_fd4 = create_server_socket(AF_INET);
+    int listen_fd6 = -1, listen_fd4 = -1;
+    if (inherit_fd != -1) {
+        if (!receive_handover(listen_fd6, listen_fd4)) return 1;
+    } else {
+        listen_fd6 = create_server_socket(AF_INET6);
+        listen_fd4 = create_server_socket(AF_INET);
+
+        if (listen_fd6 == -1 && listen_fd4 == -1) return 1;
 
-    if (listen_fd6 == -1 && listen_fd4 == -1) return 1;
+        display_assigned_port(listen_fd6, listen_fd4);
+        prepare_sockets(listen_fd6, listen_fd4);
+        if (!local_path.empty()) {
+            local_listen_fd = create_local_socket();
+            if (local_listen_fd == -1) return 1;
+        }
+    }
 
-    display_assigned_port(listen_fd6, listen_fd4);
-    prepare_sockets(listen_fd6, listen_fd4);
+    enter_low_latency_mode();
 
     do {
         server_loop(listen_fd6, listen_fd4);
-    } while (true);
+    } while (!handover_draining);
 
     cleanup(listen_fd6, listen_fd4);
+    checkpoint_close();
+    journal_close();
+    results_close();
     return 0;
 }
\ No newline at end of file
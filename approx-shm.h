@@ -0,0 +1,216 @@
+// Lokalny transport przez pamięć współdzieloną (serwer -L, klient -L).
+//
+// Klient łączy się z gniazdem uniksowym serwera i dostaje przez SCM_RIGHTS
+// memfd z dwoma pierścieniami SPSC (do serwera i do klienta) oraz dwa
+// eventfd do budzenia stron. Na pierścieniach płyną te same linie
+// protokołu co po TCP. Gniazdo uniksowe zostaje otwarte tylko po to,
+// żeby obie strony widziały rozłączenie (POLLHUP).
+//
+// Producent budzi konsumenta przez eventfd tylko wtedy, gdy ten zgłosił,
+// że zasypia w poll(); konsument aktywnie odpytujący pierścień nie kosztuje
+// więc producenta żadnego wywołania systemowego.
+
+#ifndef APPROX_SHM_H
+#define APPROX_SHM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static constexpr char SHM_MAGIC[4] = {'A', 'P', 'X', 'S'};
+static constexpr uint32_t SHM_VERSION = 1;
+static constexpr size_t SHM_RING_SIZE = 1 << 20; // potęga dwójki
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "pierścień wymaga atomików bez blokad");
+
+// Liczniki rosną bez końca; pozycja w buforze to licznik mod rozmiar.
+struct shm_ring {
+    alignas(64) std::atomic<uint64_t> head; // pisze tylko producent
+    alignas(64) std::atomic<uint64_t> tail; // pisze tylko konsument
+    alignas(64) std::atomic<uint32_t> consumer_sleeping;
+    alignas(64) char data[SHM_RING_SIZE];
+};
+
+struct shm_channel {
+    char magic[4];
+    uint32_t version;
+    uint64_t ring_size;
+    shm_ring to_server;
+    shm_ring to_client;
+};
+
+// Wiadomość powitalna na gnieździe uniksowym; towarzyszą jej kolejno
+// memfd, eventfd budzący serwer i eventfd budzący klienta.
+struct shm_handshake {
+    char magic[4];
+    uint32_t version;
+    uint64_t size; // rozmiar memfd
+};
+
+static constexpr int SHM_HANDSHAKE_FDS = 3;
+
+// Licznik drugiej strony leży w pamięci, do której ona pisze, więc przed
+// użyciem sprawdzamy, czy zajęte miejsce mieści się w pierścieniu.
+inline bool shm_ring_sane(uint64_t head, uint64_t tail) {
+    return head - tail <= SHM_RING_SIZE;
+}
+
+// Zapisuje ile się zmieści, najwyżej `len` bajtów, a liczbę zapisanych
+// podaje w `written`. Zwraca false, gdy pierścień jest uszkodzony.
+inline bool shm_ring_write(shm_ring &r, const char *src, size_t len,
+    size_t &written) {
+    written = 0;
+    uint64_t head = r.head.load(std::memory_order_relaxed);
+    uint64_t tail = r.tail.load(std::memory_order_acquire);
+    if (!shm_ring_sane(head, tail)) return false;
+    size_t n = std::min<size_t>(len, SHM_RING_SIZE - (head - tail));
+    size_t pos = head & (SHM_RING_SIZE - 1);
+    size_t first = std::min(n, SHM_RING_SIZE - pos);
+    memcpy(r.data + pos, src, first);
+    memcpy(r.data, src + first, n - first);
+    r.head.store(head + n, std::memory_order_seq_cst);
+    written = n;
+    return true;
+}
+
+// Czyta najwyżej `cap` bajtów, a liczbę przeczytanych podaje w `got`.
+// Zwraca false, gdy pierścień jest uszkodzony.
+inline bool shm_ring_read(shm_ring &r, char *dst, size_t cap, size_t &got) {
+    got = 0;
+    uint64_t tail = r.tail.load(std::memory_order_relaxed);
+    uint64_t head = r.head.load(std::memory_order_acquire);
+    if (!shm_ring_sane(head, tail)) return false;
+    size_t n = std::min<size_t>(cap, head - tail);
+    size_t pos = tail & (SHM_RING_SIZE - 1);
+    size_t first = std::min(n, SHM_RING_SIZE - pos);
+    memcpy(dst, r.data + pos, first);
+    memcpy(dst + first, r.data, n - first);
+    r.tail.store(tail + n, std::memory_order_release);
+    got = n;
+    return true;
+}
+
+inline bool shm_ring_empty(const shm_ring &r) {
+    return r.head.load(std::memory_order_seq_cst) ==
+           r.tail.load(std::memory_order_relaxed);
+}
+
+// Producent po zapisie: budzi konsumenta, jeśli ten śpi.
+inline void shm_ring_notify(shm_ring &r, int efd) {
+    if (r.consumer_sleeping.exchange(0, std::memory_order_seq_cst) != 0) {
+        uint64_t one = 1;
+        ssize_t w = write(efd, &one, sizeof(one));
+        (void)w;
+    }
+}
+
+// Konsument przed zaśnięciem w poll(). Zwraca false, jeśli w pierścieniu
+// już coś czeka i spać nie wolno. Kolejność zapis flagi -> odczyt head
+// (i po stronie producenta zapis head -> odczyt flagi) wyklucza zgubione
+// budzenie.
+inline bool shm_ring_prepare_sleep(shm_ring &r) {
+    r.consumer_sleeping.store(1, std::memory_order_seq_cst);
+    if (shm_ring_empty(r)) return true;
+    r.consumer_sleeping.store(0, std::memory_order_relaxed);
+    return false;
+}
+
+// Zeruje licznik eventfd po obudzeniu.
+inline void shm_clear_eventfd(int efd) {
+    uint64_t v;
+    ssize_t r = read(efd, &v, sizeof(v));
+    (void)r;
+}
+
+inline bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t w = write(fd, data, size);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += w;
+        size -= w;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t r = read(fd, data, size);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        data += r;
+        size -= r;
+    }
+    return true;
+}
+
+static constexpr int MAX_PASSED_FDS = 4;
+
+// Wysyła blok danych z dołączonymi deskryptorami (SCM_RIGHTS).
+inline bool send_with_fds(int sock, const void *data, size_t size,
+    const int *fds, int nfds) {
+    iovec iov{const_cast<void*>(data), size};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)]{};
+    if (nfds > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0) return false;
+    return write_all(sock, static_cast<const char*>(data) + sent, size - sent);
+}
+
+// Odbiera dokładnie `size` bajtów i deskryptory dołączone do nich.
+inline bool recv_with_fds(int sock, void *data, size_t size,
+    int *fds, int max_fds, int &nfds) {
+    nfds = 0;
+    char *p = static_cast<char*>(data);
+    while (size > 0) {
+        iovec iov{p, size};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)]{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+             cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+                continue;
+            int n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < n; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+                if (nfds < max_fds) fds[nfds++] = fd;
+                else close(fd);
+            }
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+#endif